@@ -12,9 +12,13 @@
 #include "render.c"
 #include "volume_draw.c"
 #include "light.c"
+#include "light_worker.c"
+// the micro benchmarks, only built for scripts/benchmark (see Makefile.PL):
+#ifdef CTR_BENCHMARK
+# include "benchmark.c"
+#endif
 
 
-unsigned char *ctr_chunk_read_data[CHUNK_ALEN * 4];
 
 double region_get_sector_value (void *reg, int x, int y, int z)
 {
@@ -232,41 +236,82 @@ void ctr_render_set_ambient_light (double l)
 
 MODULE = Games::Construder PACKAGE = Games::Construder::World PREFIX = ctr_world_
 
-AV *
-ctr_world_get_prof_counters ()
+SV *
+ctr_world_get_prof_counters (int reset = 0)
   CODE:
-    RETVAL = newAV ();
-    sv_2mortal ((SV *)RETVAL);
+    HV *cnt = newHV ();
+    hv_stores (cnt, "chunk_changes",         newSViv (ctr_prof_cnt.chunk_changes));
+    hv_stores (cnt, "active_cell_changes",   newSViv (ctr_prof_cnt.active_cell_changes));
+    hv_stores (cnt, "allocated_axises",      newSViv (ctr_prof_cnt.allocated_axises));
+    hv_stores (cnt, "allocated_axises_size", newSViv (ctr_prof_cnt.allocated_axises_size));
+    hv_stores (cnt, "noise_cnt",             newSViv (ctr_prof_cnt.noise_cnt));
+    hv_stores (cnt, "noise_size",            newSViv (ctr_prof_cnt.noise_size));
+    hv_stores (cnt, "dyn_buf_cnt",           newSViv (ctr_prof_cnt.dyn_buf_cnt));
+    hv_stores (cnt, "dyn_buf_size",          newSViv (ctr_prof_cnt.dyn_buf_size));
+    hv_stores (cnt, "geom_cnt",              newSViv (ctr_prof_cnt.geom_cnt));
+    hv_stores (cnt, "allocated_chunks",      newSViv (ctr_prof_cnt.allocated_chunks));
+    hv_stores (cnt, "chunk_dir_size",        newSViv (ctr_prof_cnt.chunk_dir_size));
+    hv_stores (cnt, "packed_chunks",         newSViv (ctr_prof_cnt.packed_chunks));
+    hv_stores (cnt, "packed_chunks_size",    newSViv (ctr_prof_cnt.packed_chunks_size));
+    hv_stores (cnt, "shared_chunks",         newSViv (ctr_prof_cnt.shared_chunks));
+    hv_stores (cnt, "slab_live",             newSVuv (ctr_prof_cnt.slab_live));
+    hv_stores (cnt, "slab_free",             newSVuv (ctr_prof_cnt.slab_free));
+    hv_stores (cnt, "slab_high_water",       newSVuv (ctr_prof_cnt.slab_high_water));
+    hv_stores (cnt, "slab_reserved",         newSVuv (ctr_prof_cnt.slab_reserved));
+
+    HV *tmrs = newHV ();
+    int i, b;
+    for (i = 0; i < CTR_PROF_TIMERS; i++)
+      {
+        ctr_prof_timer *t = &ctr_prof_tmr[i];
+        HV *tmr = newHV ();
+        hv_stores (tmr, "calls",    newSVnv (t->calls));
+        hv_stores (tmr, "timed",    newSVnv (t->timed));
+        hv_stores (tmr, "total_ns", newSVnv (t->total_ns));
+        hv_stores (tmr, "max_ns",   newSVnv (t->max_ns));
+
+        AV *hist = newAV ();
+        av_extend (hist, CTR_PROF_BUCKETS - 1);
+        for (b = 0; b < CTR_PROF_BUCKETS; b++)
+          av_push (hist, newSVuv (t->hist[b]));
+        hv_stores (tmr, "hist", newRV_noinc ((SV *) hist));
+
+        hv_store (tmrs, ctr_prof_timer_names[i], strlen (ctr_prof_timer_names[i]),
+                  newRV_noinc ((SV *) tmr), 0);
+      }
+
+    HV *snap = newHV ();
+    hv_stores (snap, "time_ns",  newSVnv (ctr_prof_now ()));
+    hv_stores (snap, "counters", newRV_noinc ((SV *) cnt));
+    hv_stores (snap, "timers",   newRV_noinc ((SV *) tmrs));
+    RETVAL = newRV_noinc ((SV *) snap);
 
-    av_push (RETVAL, newSViv (ctr_prof_cnt.chunk_changes));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.active_cell_changes));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.allocated_axises));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.allocated_axises_size));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.noise_cnt));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.noise_size));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.dyn_buf_cnt));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.dyn_buf_size));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.geom_cnt));
-    av_push (RETVAL, newSViv (ctr_prof_cnt.allocated_chunks));
+    if (reset)
+      ctr_prof_reset ();
 
   OUTPUT:
     RETVAL
 
+void ctr_world_set_memory_budget (double bytes, int huge_pages = 0)
+  CODE:
+    ctr_slab_set_budget ((unsigned long) bytes, huge_pages);
 
 void ctr_world_init (SV *change_cb, SV *cell_change_cb)
   CODE:
-     ctr_world_init ();
      ctr_prof_init ();
+     ctr_world_init ();
      SvREFCNT_inc (change_cb);
      WORLD.chunk_change_cb = change_cb;
      SvREFCNT_inc (cell_change_cb);
      WORLD.active_cell_change_cb = cell_change_cb;
 
 
+void ctr_world_flush_changes ();
+
 int
 ctr_world_has_chunk (int x, int y, int z)
   CODE:
-    ctr_chunk *chnk = ctr_world_chunk (x, y, z, 0);
+    ctr_chunk *chnk = ctr_world_chunk_lookup (x, y, z, 0);
     RETVAL = chnk ? 1 : 0;
   OUTPUT:
     RETVAL
@@ -274,15 +319,127 @@ ctr_world_has_chunk (int x, int y, int z)
 SV *
 ctr_world_get_chunk_data (int x, int y, int z)
   CODE:
-    ctr_chunk *chnk = ctr_world_chunk (x, y, z, 0);
+    ctr_chunk *chnk = ctr_world_chunk_lookup (x, y, z, 0);
+    if (!chnk)
+      {
+        XSRETURN_UNDEF;
+      }
+
+    // serialize right into the string buffer:
+    RETVAL = newSV (CHUNK_DATA_LEN);
+    SvPOK_only (RETVAL);
+    ctr_world_get_any_chunk_data (chnk, (unsigned char *) SvPVX (RETVAL));
+    SvCUR_set (RETVAL, CHUNK_DATA_LEN);
+  OUTPUT:
+    RETVAL
+
+int
+ctr_world_get_chunk_data_into (int x, int y, int z, SV *buf)
+  CODE:
+    ctr_chunk *chnk = ctr_world_chunk_lookup (x, y, z, 0);
     if (!chnk)
       {
         XSRETURN_UNDEF;
       }
 
-    int len = CHUNK_ALEN * 4;
-    ctr_world_get_chunk_data (chnk, (unsigned char *) &ctr_chunk_read_data);
-    RETVAL = newSVpv ((unsigned char *) &ctr_chunk_read_data, len);
+    // like get_chunk_data, but reuses the buffer of buf:
+    SvUPGRADE (buf, SVt_PV);
+    SvGROW (buf, CHUNK_DATA_LEN + 1);
+    ctr_world_get_any_chunk_data (chnk, (unsigned char *) SvPVX (buf));
+    SvCUR_set (buf, CHUNK_DATA_LEN);
+    SvPOK_only (buf);
+    RETVAL = 1;
+  OUTPUT:
+    RETVAL
+
+
+AV *
+ctr_world_get_sector_data (int sx, int sy, int sz)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    // the chunks are serialized right into the returned string:
+    int lens[CHUNKS_IN_SECTOR];
+    SV *data = newSV (CHUNKS_IN_SECTOR * CHUNK_DATA_LEN);
+    SvPOK_only (data);
+    unsigned int len =
+      ctr_world_get_sector_data (sx, sy, sz, (unsigned char *) SvPVX (data), lens);
+    SvCUR_set (data, len);
+
+    av_push (RETVAL, data);
+    int i;
+    for (i = 0; i < CHUNKS_IN_SECTOR; i++)
+      av_push (RETVAL, newSViv (lens[i]));
+  OUTPUT:
+    RETVAL
+
+int
+ctr_world_set_sector_data (int sx, int sy, int sz, SV *data, AV *lens)
+  CODE:
+    if (av_len (lens) + 1 != CHUNKS_IN_SECTOR)
+      croak ("Games::Construder: got %d chunk lengths for a sector of %d chunks",
+             (int) av_len (lens) + 1, CHUNKS_IN_SECTOR);
+
+    int clens[CHUNKS_IN_SECTOR];
+    int i;
+    for (i = 0; i < CHUNKS_IN_SECTOR; i++)
+      {
+        SV **l = av_fetch (lens, i, 0);
+        clens[i] = l ? SvIV (*l) : 0;
+      }
+
+    STRLEN len;
+    unsigned char *ptr = (unsigned char *) SvPVbyte (data, len);
+    RETVAL = ctr_world_set_sector_data (sx, sy, sz, ptr, len, clens);
+    if (RETVAL < 0)
+      croak ("Games::Construder: sector data of %d bytes doesn't match its chunk lengths",
+             (int) len);
+  OUTPUT:
+    RETVAL
+
+AV *
+ctr_world_get_chunk_changes (int x, int y, int z, UV since)
+  CODE:
+    ctr_chunk *chnk = ctr_world_chunk_lookup (x, y, z, 0);
+    if (!chnk)
+      {
+        XSRETURN_UNDEF;
+      }
+
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    static unsigned char changes[CTR_CHUNK_CHANGES * CTR_CHUNK_CHANGE_LEN];
+    int cnt = ctr_chunk_get_changes (chnk, since, changes);
+
+    av_push (RETVAL, newSVuv (chnk->version));
+    av_push (RETVAL,
+      cnt < 0 ? newSV (0) : newSVpvn (changes, cnt * CTR_CHUNK_CHANGE_LEN));
+  OUTPUT:
+    RETVAL
+
+
+AV *
+ctr_world_get_chunk_versions (AV *positions)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    // positions is a flat list of chunk coordinates, undef for missing chunks:
+    int len = av_len (positions) + 1;
+    int i;
+    for (i = 0; i + 2 < len; i += 3)
+      {
+        SV **x = av_fetch (positions, i, 0),
+           **y = av_fetch (positions, i + 1, 0),
+           **z = av_fetch (positions, i + 2, 0);
+        ctr_chunk *chnk =
+          (x && y && z)
+            ? ctr_world_chunk_lookup (SvIV (*x), SvIV (*y), SvIV (*z), 0)
+            : 0;
+        av_push (RETVAL, chnk ? newSVuv (chnk->version) : newSV (0));
+      }
   OUTPUT:
     RETVAL
 
@@ -298,11 +455,10 @@ int ctr_world_set_chunk_data (int x, int y, int z, unsigned char *data, unsigned
         printf ("CHUNK DATA LEN DOES NOT FIT! %d vs %d\n", len, lenc);
         exit (1);
       }
-
-    // FIXME: this needs to be done for neighborss where whe changed too!!!
-    ctr_world_chunk_calc_visibility (chnk);
+    ctr_chunk_share (chnk, ctr_chunk_data_hash (data));
 
     ctr_world_emit_chunk_change (x, y, z);
+    ctr_world_flush_changes ();
 
     //d// ctr_world_dump ();
   OUTPUT:
@@ -310,6 +466,22 @@ int ctr_world_set_chunk_data (int x, int y, int z, unsigned char *data, unsigned
 
 void ctr_world_purge_chunk (int x, int y, int z);
 
+void ctr_world_set_visibility (int enable);
+
+int ctr_world_chunk_size ()
+  CODE:
+    RETVAL = CHUNK_SIZE;
+  OUTPUT:
+    RETVAL
+
+int ctr_world_chunks_per_sector ()
+  CODE:
+    RETVAL = CHUNKS_P_SECTOR;
+  OUTPUT:
+    RETVAL
+
+int ctr_world_tick (unsigned int pack_after = 0);
+
 int ctr_world_is_solid_at (double x, double y, double z)
   CODE:
     RETVAL = 1;
@@ -317,8 +489,8 @@ int ctr_world_is_solid_at (double x, double y, double z)
     ctr_chunk *chnk = ctr_world_chunk_at (x, y, z, 0);
     if (chnk)
       {
-        ctr_cell *c = ctr_chunk_cell_at_abs (chnk, x, y, z);
-        ctr_obj_attr *attr = ctr_world_get_attr (c->type);
+        unsigned int offs = ctr_chunk_offs_at_abs (x, y, z);
+        ctr_obj_attr *attr = ctr_world_get_attr (CELL_TYPE (chnk, offs));
         RETVAL = attr ? attr->blocking : 0;
       }
   OUTPUT:
@@ -337,12 +509,13 @@ ctr_world_at (double x, double y, double z)
     ctr_chunk *chnk = ctr_world_chunk_at (x, y, z, 0);
     if (chnk)
       {
-        ctr_cell *c = ctr_chunk_cell_at_abs (chnk, x, y, z);
-        av_push (RETVAL, newSViv (c->type));
-        av_push (RETVAL, newSViv (c->light));
-        av_push (RETVAL, newSViv (c->meta));
-        av_push (RETVAL, newSViv (c->add));
-        av_push (RETVAL, newSViv (c->visible));
+        unsigned int offs = ctr_chunk_offs_at_abs (x, y, z);
+        ctr_chunk_visibility (chnk);
+        av_push (RETVAL, newSViv (CELL_TYPE (chnk, offs)));
+        av_push (RETVAL, newSViv (CELL_LIGHT (chnk, offs)));
+        av_push (RETVAL, newSViv (CELL_META (chnk, offs)));
+        av_push (RETVAL, newSViv (CELL_ADD (chnk, offs)));
+        av_push (RETVAL, newSViv (CELL_VISIBLE (chnk, offs)));
       }
 
   OUTPUT:
@@ -356,39 +529,88 @@ ctr_world_chunk_visible_faces (int x, int y, int z)
     RETVAL = newAV ();
     sv_2mortal ((SV *)RETVAL);
 
-    for (z = 0; z < CHUNK_SIZE; z++)
-      for (y = 0; y < CHUNK_SIZE; y++)
-        for (x = 0; x < CHUNK_SIZE; x++)
-          {
-            if (chnk->cells[REL_POS2OFFS(x, y, z)].visible)
-              {
-                av_push (RETVAL, newSViv (chnk->cells[REL_POS2OFFS(x, y, z)].type));
-                av_push (RETVAL, newSVnv (x));
-                av_push (RETVAL, newSVnv (y));
-                av_push (RETVAL, newSVnv (z));
-              }
-          }
+    // empty chunks have no visible faces:
+    if (chnk)
+      {
+        ctr_chunk_visibility (chnk);
+        ctr_chunk_summary (chnk);
+      }
+    if (chnk && chnk->nonair)
+      for (z = 0; z < CHUNK_SIZE; z++)
+        for (y = 0; y < CHUNK_SIZE; y++)
+          for (x = 0; x < CHUNK_SIZE; x++)
+            {
+              unsigned int offs = REL_POS2OFFS(x, y, z);
+              if (CELL_VISIBLE (chnk, offs))
+                {
+                  av_push (RETVAL, newSViv (CELL_TYPE (chnk, offs)));
+                  av_push (RETVAL, newSVnv (x));
+                  av_push (RETVAL, newSVnv (y));
+                  av_push (RETVAL, newSVnv (z));
+                }
+            }
+
+  OUTPUT:
+    RETVAL
+
+AV *
+ctr_world_chunk_summary (int x, int y, int z)
+  CODE:
+    ctr_chunk *chnk = ctr_world_chunk (x, y, z, 0);
+    if (!chnk)
+      XSRETURN_UNDEF;
 
+    ctr_chunk_summary (chnk);
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+    av_push (RETVAL, newSViv (chnk->nonair));
+    av_push (RETVAL, newSViv (chnk->opaque));
+    av_push (RETVAL, newSViv (chnk->uniform ? chnk->uniform_type : -1));
+    av_push (RETVAL, newSViv (ctr_chunk_opaque_faces (chnk)));
+    av_push (RETVAL, newSViv (ctr_chunk_buried (chnk)));
   OUTPUT:
     RETVAL
 
-void ctr_world_query_load_chunks (int alloc = 0);
+void *ctr_world_query_new ();
+
+void ctr_world_query_free (void *q);
+
+void ctr_world_query_load_chunks (int alloc = 0, void *q = 0)
+  CODE:
+    QUERY_USE (q);
+    ctr_world_query_load_chunks (alloc);
+    QUERY_DONE ();
 
-void ctr_world_query_set_at (unsigned int rel_x, unsigned int rel_y, unsigned int rel_z, AV *cell)
+void ctr_world_query_set_at (unsigned int rel_x, unsigned int rel_y, unsigned int rel_z, AV *cell, void *q = 0)
   CODE:
+    QUERY_USE (q);
     ctr_world_query_set_at_pl (rel_x, rel_y, rel_z, cell);
+    QUERY_DONE ();
 
-void ctr_world_query_set_at_abs (unsigned int rel_x, unsigned int rel_y, unsigned int rel_z, AV *cell)
+void ctr_world_query_set_at_abs (unsigned int rel_x, unsigned int rel_y, unsigned int rel_z, AV *cell, void *q = 0)
   CODE:
+    QUERY_USE (q);
     ctr_world_query_abs2rel (&rel_x, &rel_y, &rel_z);
     ctr_world_query_set_at_pl (rel_x, rel_y, rel_z, cell);
+    QUERY_DONE ();
 
-void ctr_world_query_setup (int x, int y, int z, int ex, int ey, int ez);
+void ctr_world_query_setup (int x, int y, int z, int ex, int ey, int ez, void *q = 0)
+  CODE:
+    QUERY_USE (q);
+    ctr_world_query_setup (x, y, z, ex, ey, ez);
+    QUERY_DONE ();
 
-int ctr_world_query_desetup (int no_update = 0);
+int ctr_world_query_desetup (int no_update = 0, void *q = 0)
+  CODE:
+    QUERY_USE (q);
+    RETVAL = ctr_world_query_desetup (no_update);
+    QUERY_DONE ();
+  OUTPUT:
+    RETVAL
 
-AV *ctr_world_query_possible_light_positions ()
+AV *ctr_world_query_possible_light_positions (void *q = 0)
   CODE:
+    QUERY_USE (q);
     int xw = QUERY_CONTEXT.x_w * CHUNK_SIZE,
         yw = QUERY_CONTEXT.y_w * CHUNK_SIZE,
         zw = QUERY_CONTEXT.z_w * CHUNK_SIZE;
@@ -423,16 +645,17 @@ AV *ctr_world_query_possible_light_positions ()
                          py = y + offsets[i][1] * (m - 1),
                          pz = z + offsets[i][2] * (m - 1);
 
-                     ctr_cell *cur = ctr_world_query_cell_at (px, py, pz, 0);
-                     if (!cur || cur->type != 0)
+                     unsigned int offs;
+                     ctr_chunk *cur = ctr_world_query_cell_at (px, py, pz, 0, &offs);
+                     if (!cur || CELL_TYPE (cur, offs) != 0)
                        continue;
 
                      cur = ctr_world_query_cell_at (
                        x + offsets[i][0] * m,
                        y + offsets[i][1] * m,
                        z + offsets[i][2] * m,
-                       0);
-                     if (cur && cur->type != 0)
+                       0, &offs);
+                     if (cur && CELL_TYPE (cur, offs) != 0)
                        {
                          av_push (RETVAL,
                                   newSViv (px + QUERY_CONTEXT.chnk_x * CHUNK_SIZE));
@@ -446,6 +669,7 @@ AV *ctr_world_query_possible_light_positions ()
                    }
                }
            }
+    QUERY_DONE ();
   OUTPUT:
     RETVAL
 
@@ -458,6 +682,7 @@ AV *ctr_world_find_free_spot (int x, int y, int z, int with_floor)
         chnk_y = pos[1],
         chnk_z = pos[2];
 
+    QUERY_USE_FIXED (&ctr_world_query_scratch);
     ctr_world_query_setup (
       chnk_x - 2, chnk_y - 2, chnk_z - 2,
       chnk_x + 2, chnk_y + 2, chnk_z + 2
@@ -483,24 +708,25 @@ AV *ctr_world_find_free_spot (int x, int y, int z, int with_floor)
                   dy = iy + cy,
                   dz = iz + cz;
 
-              ctr_cell *cur = ctr_world_query_cell_at (dx, dy, dz, 0);
+              unsigned int offs;
+              ctr_chunk *cur = ctr_world_query_cell_at (dx, dy, dz, 0, &offs);
               if (!cur)
                 continue;
-              ctr_obj_attr *attr = ctr_world_get_attr (cur->type);
+              ctr_obj_attr *attr = ctr_world_get_attr (CELL_TYPE (cur, offs));
               if (attr->blocking)
                 continue;
 
-              cur = ctr_world_query_cell_at (dx, dy + 1, dz, 0);
+              cur = ctr_world_query_cell_at (dx, dy + 1, dz, 0, &offs);
               if (!cur)
                 continue;
-              attr = ctr_world_get_attr (cur->type);
+              attr = ctr_world_get_attr (CELL_TYPE (cur, offs));
               if (attr->blocking)
                 continue;
 
-              cur = ctr_world_query_cell_at (dx, dy - 1, dz, 0);
+              cur = ctr_world_query_cell_at (dx, dy - 1, dz, 0, &offs);
               if (!cur)
                 continue;
-              attr = ctr_world_get_attr (cur->type);
+              attr = ctr_world_get_attr (CELL_TYPE (cur, offs));
               if (with_floor && !attr->blocking)
                 continue;
 
@@ -510,6 +736,8 @@ AV *ctr_world_find_free_spot (int x, int y, int z, int with_floor)
               found = 1;
             }
 
+    QUERY_DONE ();
+
   OUTPUT:
     RETVAL
 
@@ -523,6 +751,7 @@ AV *ctr_world_get_types_in_cube (int x, int y, int z, int size, int type_match =
     vec3_s_div (pos2, CHUNK_SIZE);
     vec3_floor (pos2);
 
+    QUERY_USE_FIXED (&ctr_world_query_scratch);
     ctr_world_query_setup (
       (int) pos1[0], (int) pos1[1], (int) pos1[2],
       (int) pos2[0], (int) pos2[1], (int) pos2[2]
@@ -536,30 +765,110 @@ AV *ctr_world_get_types_in_cube (int x, int y, int z, int size, int type_match =
     RETVAL = newAV ();
     sv_2mortal ((SV *)RETVAL);
 
-    int dx, dy, dz;
-    for (dx = 0; dx < size; dx++)
-      for (dy = 0; dy < size; dy++)
-        for (dz = 0; dz < size; dz++)
+    if (type_match >= 0 && CTR_IS_SPECIAL_TYPE (type_match))
+      {
+        // the cells are in the index of special cells of the chunks,
+        // collect their offsets in the cube and sort them into x, y, z order:
+        int *found = 0;
+        unsigned int n = 0, n_size = 0;
+        int qx, qy, qz;
+        for (qz = 0; qz < QUERY_CONTEXT.z_w; qz++)
+          for (qy = 0; qy < QUERY_CONTEXT.y_w; qy++)
+            for (qx = 0; qx < QUERY_CONTEXT.x_w; qx++)
+              {
+                ctr_chunk *chnk = QUERY_CHUNK(qx, qy, qz);
+                if (!chnk)
+                  continue;
+
+                unsigned short *special = ctr_chunk_special (chnk);
+                unsigned int i;
+                for (i = 0; i < chnk->special_len; i++)
+                  {
+                    unsigned int offs = special[i];
+                    ctr_cell cell;
+                    if (chnk->packed)
+                      ctr_chunk_packed_cell (chnk, offs, &cell);
+                    else
+                      cell.type = CELL_TYPE (chnk, offs);
+                    if (cell.type != type_match)
+                      continue;
+
+                    int dx = qx * CHUNK_SIZE + offs % CHUNK_SIZE - cx,
+                        dy = qy * CHUNK_SIZE + (offs / CHUNK_SIZE) % CHUNK_SIZE - cy,
+                        dz = qz * CHUNK_SIZE + offs / (CHUNK_SIZE * CHUNK_SIZE) - cz;
+                    if (dx < 0 || dy < 0 || dz < 0
+                        || dx >= size || dy >= size || dz >= size)
+                      continue;
+
+                    if (n == n_size)
+                      {
+                        n_size = n_size ? n_size * 2 : 16;
+                        found = saferealloc (found, sizeof (int) * n_size);
+                      }
+                    found[n++] = (dx * size + dy) * size + dz;
+                  }
+              }
+
+        if (n)
+          qsort (found, n, sizeof (int), ctr_cmp_int);
+        unsigned int i;
+        for (i = 0; i < n; i++)
           {
-            ctr_cell *cur = ctr_world_query_cell_at (cx + dx, cy + dy, cz + dz, 0);
-            if (!cur)
-              continue;
+            av_push (RETVAL, newSViv (x + found[i] / (size * size)));
+            av_push (RETVAL, newSViv (y + (found[i] / size) % size));
+            av_push (RETVAL, newSViv (z + found[i] % size));
+            av_push (RETVAL, newSViv (type_match));
+          }
+        if (found)
+          safefree (found);
+      }
+    else
+      {
+        // gather the types chunk by chunk, -1 for cells without chunk:
+        int *types = safemalloc (sizeof (int) * (size > 0 ? size * size * size : 1));
+        int dx, dy, dz;
+        for (dx = 0; dx < size * size * size; dx++)
+          types[dx] = -1;
+
+        ctr_world_query_cursor c;
+        ctr_world_query_cursor_init (
+          &c, cx, cy, cz, cx + size - 1, cy + size - 1, cz + size - 1, 0);
+        while (ctr_world_query_cursor_next (&c))
+          {
+            unsigned short *type = &(c.chnk->cells->type[c.offs]);
+            int *out = &(types[(c.x - cx) * size * size + (c.y - cy) * size + (c.z - cz)]);
+            unsigned int i;
+            for (i = 0; i < c.len; i++)
+              out[i * size * size] = type[i];
+          }
 
-            if (type_match >= 0)
+        // and hand them out in x, y, z order:
+        int *t = types;
+        for (dx = 0; dx < size; dx++)
+          for (dy = 0; dy < size; dy++)
+            for (dz = 0; dz < size; dz++, t++)
               {
-                if (cur->type == type_match)
+                if (*t < 0)
+                  continue;
+
+                if (type_match >= 0)
                   {
-                    av_push (RETVAL, newSViv (x + dx));
-                    av_push (RETVAL, newSViv (y + dy));
-                    av_push (RETVAL, newSViv (z + dz));
-                    av_push (RETVAL, newSViv (cur->type));
+                    if (*t == type_match)
+                      {
+                        av_push (RETVAL, newSViv (x + dx));
+                        av_push (RETVAL, newSViv (y + dy));
+                        av_push (RETVAL, newSViv (z + dz));
+                        av_push (RETVAL, newSViv (*t));
+                      }
                   }
+                else
+                  av_push (RETVAL, newSViv (*t));
               }
-            else
-              av_push (RETVAL, newSViv (cur->type));
-          }
+        safefree (types);
+      }
 
     ctr_world_query_desetup (1);
+    QUERY_DONE ();
 
   OUTPUT:
     RETVAL
@@ -573,6 +882,7 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
         chnk_y = pos[1],
         chnk_z = pos[2];
 
+    QUERY_USE_FIXED (&ctr_world_query_scratch);
     ctr_world_query_setup (
       chnk_x - 1, chnk_y - 1, chnk_z - 1,
       chnk_x + 1, chnk_y + 1, chnk_z + 1
@@ -590,20 +900,21 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
     //d// printf ("QUERY AT %d %d %d\n", cx, cy, cz);
 
     // find lowest cx/cz coord with constr. floor
-    ctr_cell *cur = ctr_world_query_cell_at (cx, cy, cz, 0);
-    while (cur && cur->type == 36)
+    unsigned int offs;
+    ctr_chunk *cur = ctr_world_query_cell_at (cx, cy, cz, 0, &offs);
+    while (cur && CELL_TYPE (cur, offs) == 36)
       {
         cx--;
         printf ("CX %d\n", cx);
-        cur = ctr_world_query_cell_at (cx, cy, cz, 0);
+        cur = ctr_world_query_cell_at (cx, cy, cz, 0, &offs);
       }
 
     cx++;
-    cur = ctr_world_query_cell_at (cx, cy, cz, 0);
-    while (cur && cur->type == 36)
+    cur = ctr_world_query_cell_at (cx, cy, cz, 0, &offs);
+    while (cur && CELL_TYPE (cur, offs) == 36)
       {
         cz--;
-        cur = ctr_world_query_cell_at (cx, cy, cz, 0);
+        cur = ctr_world_query_cell_at (cx, cy, cz, 0, &offs);
       }
     cz++;
 
@@ -619,9 +930,10 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
         for (dx = 0; dx < dim; dx++)
           for (dz = 0; dz < dim; dz++)
             {
-              ctr_cell *cur = ctr_world_query_cell_at (cx + dx, cy, cz + dz, 0);
-              //d// printf ("TXT[%d] %d %d %d: %d\n", dim, cx + dx, cy, cz + dz, cur->type);
-              if (!cur || cur->type != 36)
+              unsigned int offs;
+              ctr_chunk *cur = ctr_world_query_cell_at (cx + dx, cy, cz + dz, 0, &offs);
+              //d// printf ("TXT[%d] %d %d %d: %d\n", dim, cx + dx, cy, cz + dz, CELL_TYPE (cur, offs));
+              if (!cur || CELL_TYPE (cur, offs) != 36)
                 no_floor = 1;
             }
         if (!no_floor)
@@ -631,6 +943,7 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
     if (dim <= 0)
       {
         ctr_world_query_desetup (1);
+        QUERY_DONE ();
         XSRETURN_UNDEF;
       }
 
@@ -646,8 +959,8 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
             int ix = dx + cx,
                 iy = dy + cy,
                 iz = dz + cz;
-            cur = ctr_world_query_cell_at (ix, iy, iz, 0);
-            if (cur && cur->type != 0)
+            cur = ctr_world_query_cell_at (ix, iy, iz, 0, &offs);
+            if (cur && CELL_TYPE (cur, offs) != 0)
               {
                 if (min_x > ix) min_x = ix;
                 if (min_y > iy) min_y = iy;
@@ -662,8 +975,8 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
             int ix = dx + cx,
                 iy = dy + cy,
                 iz = dz + cz;
-            cur = ctr_world_query_cell_at (ix, iy, iz, 0);
-            if (cur && cur->type != 0)
+            cur = ctr_world_query_cell_at (ix, iy, iz, 0, &offs);
+            if (cur && CELL_TYPE (cur, offs) != 0)
               {
                 if (max_x < ix) max_x = ix;
                 if (max_y < iy) max_y = iy;
@@ -700,8 +1013,8 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
                 continue;
               }
 
-            cur = ctr_world_query_cell_at (ix, iy, iz, 0);
-            if (cur && cur->type != 0)
+            cur = ctr_world_query_cell_at (ix, iy, iz, 0, &offs);
+            if (cur && CELL_TYPE (cur, offs) != 0)
               {
                 if (mutate == 1)
                   {
@@ -712,7 +1025,7 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
                 else
                   {
                     av_push (RETVAL, newSViv (blk_nr));
-                    av_push (RETVAL, newSViv (cur->type));
+                    av_push (RETVAL, newSViv (CELL_TYPE (cur, offs)));
                   }
               }
 
@@ -720,6 +1033,7 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
           }
 
     ctr_world_query_desetup (1);
+    QUERY_DONE ();
 
   OUTPUT:
     RETVAL
@@ -727,8 +1041,9 @@ AV *ctr_world_get_pattern (int x, int y, int z, int mutate)
 
 #define DEBUG_LIGHT 0
 
-void ctr_world_flow_light_query_setup (int minx, int miny, int minz, int maxx, int maxy, int maxz)
+void ctr_world_flow_light_query_setup (int minx, int miny, int minz, int maxx, int maxy, int maxz, void *q = 0)
   CODE:
+    QUERY_USE (q);
     vec3_init (min_pos, minx, miny, minz);
     vec3_s_div (min_pos, CHUNK_SIZE);
     vec3_floor (min_pos);
@@ -742,54 +1057,107 @@ void ctr_world_flow_light_query_setup (int minx, int miny, int minz, int maxx, i
     );
 
     ctr_world_query_load_chunks (0);
+    QUERY_DONE ();
 
 
-AV *ctr_world_query_search_types (int t1, int t2, int t3)
+AV *ctr_world_query_search_types (int t1, int t2, int t3, void *q = 0)
   CODE:
     RETVAL = newAV ();
     sv_2mortal ((SV *)RETVAL);
-
-    int xw = QUERY_CONTEXT.x_w * CHUNK_SIZE,
-        yw = QUERY_CONTEXT.y_w * CHUNK_SIZE,
-        zw = QUERY_CONTEXT.z_w * CHUNK_SIZE;
-    int x, y, z;
-    for (x = 0; x < xw; x++)
-      for (y = 0; y < yw; y++)
-        for (z = 0; z < zw; z++)
-           {
-             ctr_cell *cur = ctr_world_query_cell_at (x, y, z, 0);
-             if (cur && (cur->type == t1 || cur->type == t2 || cur->type == t3))
-               {
-                  int rx = x, ry = y, rz = z;
-                  ctr_world_query_rel2abs (&rx, &ry, &rz);
-                  av_push (RETVAL, newSViv (rx));
-                  av_push (RETVAL, newSViv (ry));
-                  av_push (RETVAL, newSViv (rz));
-               }
-           }
+    QUERY_USE (q);
+    ctr_world_query_search_types (t1, t2, t3, RETVAL);
+    QUERY_DONE ();
 
   OUTPUT:
     RETVAL
 
-void ctr_world_query_reflow_every_light ()
+void ctr_world_query_reflow_every_light (void *q = 0)
   CODE:
-    int xw = QUERY_CONTEXT.x_w * CHUNK_SIZE,
-        yw = QUERY_CONTEXT.y_w * CHUNK_SIZE,
-        zw = QUERY_CONTEXT.z_w * CHUNK_SIZE;
-    int x, y, z;
-    for (x = 0; x < xw; x++)
-      for (y = 0; y < yw; y++)
-        for (z = 0; z < zw; z++)
-           {
-             ctr_cell *cur = ctr_world_query_cell_at (x, y, z, 0);
-             if (cur && (cur->type == 35 || cur->type == 40 || cur->type == 41))
-               ctr_world_query_reflow_light (x, y, z);
-           }
+    QUERY_USE (q);
+    // the lights are in the index of special cells of each chunk:
+    int cx, cy, cz;
+    for (cz = 0; cz < QUERY_CONTEXT.z_w; cz++)
+      for (cy = 0; cy < QUERY_CONTEXT.y_w; cy++)
+        for (cx = 0; cx < QUERY_CONTEXT.x_w; cx++)
+          {
+            ctr_chunk *chnk = QUERY_CHUNK(cx, cy, cz);
+            if (!chnk)
+              continue;
 
-void ctr_world_flow_light_at (int x, int y, int z)
+            unsigned short *special = ctr_chunk_special (chnk);
+            if (chnk->special_len)
+              ctr_chunk_touch (chnk);
+
+            unsigned int i;
+            for (i = 0; i < chnk->special_len; i++)
+              {
+                unsigned int offs = special[i];
+                if (!CTR_IS_LIGHT_TYPE (CELL_TYPE (chnk, offs)))
+                  continue;
+
+                CTR_PROF_BEGIN (t_start);
+                ctr_world_query_reflow_light (
+                  cx * CHUNK_SIZE + offs % CHUNK_SIZE,
+                  cy * CHUNK_SIZE + (offs / CHUNK_SIZE) % CHUNK_SIZE,
+                  cz * CHUNK_SIZE + offs / (CHUNK_SIZE * CHUNK_SIZE));
+                CTR_PROF_END (CTR_PROF_LIGHT, t_start);
+              }
+          }
+    QUERY_DONE ();
+
+void ctr_world_flow_light_at (int x, int y, int z, void *q = 0)
   CODE:
+    QUERY_USE (q);
     ctr_world_query_abs2rel (&x, &y, &z);
+    CTR_PROF_BEGIN (t_start);
     ctr_world_query_reflow_light (x, y, z);
+    CTR_PROF_END (CTR_PROF_LIGHT, t_start);
+    QUERY_DONE ();
+
+void ctr_world_flow_light_sector (int sector_x, int sector_y, int sector_z, void *q = 0)
+  CODE:
+    QUERY_USE (q);
+    int size = CHUNKS_P_SECTOR * CHUNK_SIZE;
+    int x = sector_x * size, y = sector_y * size, z = sector_z * size,
+        ex = x + size - 1, ey = y + size - 1, ez = z + size - 1;
+    ctr_world_query_abs2rel (&x, &y, &z);
+    ctr_world_query_abs2rel (&ex, &ey, &ez);
+    CTR_PROF_BEGIN (t_start);
+    ctr_world_query_relight_box (x, y, z, ex, ey, ez);
+    CTR_PROF_END (CTR_PROF_LIGHT, t_start);
+    QUERY_DONE ();
+
+void ctr_world_flow_light_box (int x, int y, int z, int ex, int ey, int ez, void *q = 0)
+  CODE:
+    QUERY_USE (q);
+    ctr_world_query_abs2rel (&x, &y, &z);
+    ctr_world_query_abs2rel (&ex, &ey, &ez);
+    CTR_PROF_BEGIN (t_start);
+    ctr_world_query_relight_box (x, y, z, ex, ey, ez);
+    CTR_PROF_END (CTR_PROF_LIGHT, t_start);
+    QUERY_DONE ();
+
+int ctr_world_light_workers (int cnt);
+
+int ctr_world_light_sector_job (int sector_x, int sector_y, int sector_z)
+  CODE:
+    CTR_PROF_BEGIN (t_start);
+    RETVAL = ctr_world_light_sector_job (sector_x, sector_y, sector_z);
+    CTR_PROF_END (CTR_PROF_LIGHT, t_start);
+  OUTPUT:
+    RETVAL
+
+int ctr_world_light_jobs_commit ()
+  CODE:
+    CTR_PROF_BEGIN (t_start);
+    RETVAL = ctr_world_light_jobs_commit ();
+    CTR_PROF_END (CTR_PROF_LIGHT, t_start);
+  OUTPUT:
+    RETVAL
+
+int ctr_world_light_jobs_pending ();
+
+int ctr_world_light_sector_pending (int sector_x, int sector_y, int sector_z);
 
 
 MODULE = Games::Construder PACKAGE = Games::Construder::VolDraw PREFIX = vol_draw_
@@ -814,39 +1182,72 @@ void vol_draw_val (double val);
 
 void vol_draw_dst_self ();
 
-void vol_draw_subdiv (int type, float x, float y, float z, float size, float shrink_fact, int lvl);
-
-void vol_draw_fill_simple_noise_octaves (unsigned int seed, unsigned int octaves, double factor, double persistence);
-
-void vol_draw_mandel_box (double xc, double yc, double zc, double xsc, double ysc, double zsc, double s, double r, double f, int it, double cfact);
-
-void vol_draw_menger_sponge_box (float x, float y, float z, float size, unsigned short lvl);
-
-void vol_draw_cantor_dust_box (float x, float y, float z, float size, unsigned short lvl);
-
-void vol_draw_sierpinski_pyramid (float x, float y, float z, float size, unsigned short lvl);
-
-void vol_draw_self_sim_cubes_hash_seed (float x, float y, float z, float size, unsigned int corners, unsigned int seed, unsigned short lvl);
-
-void vol_draw_map_range (float a, float b, float x, float y);
+void vol_draw_subdiv (int type, float x, float y, float z, float size, float shrink_fact, int lvl)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
+
+void vol_draw_fill_simple_noise_octaves (unsigned int seed, unsigned int octaves, double factor, double persistence)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
+
+void vol_draw_mandel_box (double xc, double yc, double zc, double xsc, double ysc, double zsc, double s, double r, double f, int it, double cfact)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
+
+void vol_draw_menger_sponge_box (float x, float y, float z, float size, unsigned short lvl)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
+
+void vol_draw_cantor_dust_box (float x, float y, float z, float size, unsigned short lvl)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
+
+void vol_draw_sierpinski_pyramid (float x, float y, float z, float size, unsigned short lvl)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
+
+void vol_draw_self_sim_cubes_hash_seed (float x, float y, float z, float size, unsigned int corners, unsigned int seed, unsigned short lvl)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
+
+void vol_draw_map_range (float a, float b, float x, float y)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
 
 void vol_draw_copy (void *dst_arr);
 
-void vol_draw_histogram_equalize (int buckets, double a, double b);
+void vol_draw_histogram_equalize (int buckets, double a, double b)
+  INIT:
+    CTR_PROF_BEGIN (t_start);
+  POSTCALL:
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
 
 int vol_draw_count_in_range (double a, double b)
   CODE:
+    CTR_PROF_BEGIN (t_start);
+    // linear pass over the buffer, the order of the cells does not matter
     int c = 0;
-    int x, y, z;
-    for (x = 0; x < DRAW_CTX.size; x++)
-      for (y = 0; y < DRAW_CTX.size; y++)
-        for (z = 0; z < DRAW_CTX.size; z++)
-          {
-            double v = DRAW_DST (x, y, z);
-            if (v >= a && v < b)
-              c++;
-          }
+    unsigned int i, len = DRAW_CTX.size * DRAW_CTX.size * DRAW_CTX.size;
+    for (i = 0; i < len; i++)
+      c += DRAW_CTX.dst[i] >= a && DRAW_CTX.dst[i] < b;
     RETVAL = c;
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
   OUTPUT:
     RETVAL
 
@@ -866,8 +1267,10 @@ AV *vol_draw_to_perl ()
   OUTPUT:
     RETVAL
 
-void vol_draw_dst_to_world (int sector_x, int sector_y, int sector_z, AV *range_map)
+void vol_draw_dst_to_world (int sector_x, int sector_y, int sector_z, AV *range_map, void *q = 0)
   CODE:
+    CTR_PROF_BEGIN (t_start);
+    QUERY_USE (q);
     int cx = sector_x * CHUNKS_P_SECTOR,
         cy = sector_y * CHUNKS_P_SECTOR,
         cz = sector_z * CHUNKS_P_SECTOR;
@@ -880,35 +1283,177 @@ void vol_draw_dst_to_world (int sector_x, int sector_y, int sector_z, AV *range_
     );
 
     ctr_world_query_load_chunks (1);
-    int x, y, z;
-    for (x = 0; x < DRAW_CTX.size; x++)
-      for (y = 0; y < DRAW_CTX.size; y++)
-        for (z = 0; z < DRAW_CTX.size; z++)
-          {
-            ctr_cell *cur = ctr_world_query_cell_at (x, y, z, 1);
-            assert (cur);
-            double v = DRAW_DST(x, y, z);
 
-            int al = av_len (range_map);
-            int i;
-            for (i = 0; i <= al; i += 3)
-              {
-                SV **a = av_fetch (range_map, i, 0);
-                SV **b = av_fetch (range_map, i + 1, 0);
-                SV **t = av_fetch (range_map, i + 2, 0);
-                if (!a || !b || !v)
-                  continue;
+    // the range map is a list of (a, b, type): values in [a, b) become type.
+    int al = av_len (range_map);
+    int nranges = 0, i;
+    double *ra = safemalloc (sizeof (double) * (al / 3 + 1) * 2),
+           *rb = ra + (al / 3 + 1);
+    int    *rt = safemalloc (sizeof (int) * (al / 3 + 1));
+    for (i = 0; i <= al; i += 3)
+      {
+        SV **a = av_fetch (range_map, i, 0);
+        SV **b = av_fetch (range_map, i + 1, 0);
+        SV **t = av_fetch (range_map, i + 2, 0);
+        if (!a || !b || !t)
+          continue;
+
+        ra[nranges] = SvNV (*a);
+        rb[nranges] = SvNV (*b);
+        rt[nranges] = SvIV (*t);
+        nranges++;
+      }
 
-                double av = SvNV (*a),
-                       bv = SvNV (*b);
-                if (v >= av && v < bv)
-                  {
-                    cur->type = SvIV (*t);
-                    if (ctr_world_is_active (cur->type))
-                      ctr_world_emit_active_cell_change (x, y, z, cur, 0);
-                  }
-              }
+    ctr_world_query_cursor c;
+    ctr_world_query_cursor_init (
+      &c, 0, 0, 0, DRAW_CTX.size - 1, DRAW_CTX.size - 1, DRAW_CTX.size - 1, 1);
+    while (ctr_world_query_cursor_next (&c))
+      {
+        double *v = &(DRAW_DST (c.x, c.y, c.z));
+        unsigned short *type = &(c.chnk->cells->type[c.offs]);
+        unsigned int j;
+        for (j = 0; j < c.len; j++)
+          {
+            if (!v[j])
+              continue;
+
+            for (i = 0; i < nranges; i++)
+              if (v[j] >= ra[i] && v[j] < rb[i])
+                {
+                  type[j] = rt[i];
+                  if (ctr_world_is_active (type[j]))
+                    {
+                      int ax = c.x + j, ay = c.y, az = c.z;
+                      ctr_world_query_rel2abs (&ax, &ay, &az);
+                      ctr_world_emit_active_cell_change (ax, ay, az, type[j], 0);
+                    }
+                }
           }
+      }
+    safefree (ra);
+    safefree (rt);
+    QUERY_DONE ();
+    CTR_PROF_END (CTR_PROF_VOL_DRAW, t_start);
+
+MODULE = Games::Construder PACKAGE = Games::Construder::Bench PREFIX = ctr_bench_
+
+#ifdef CTR_BENCHMARK
+
+AV *ctr_bench_chunk_dir (unsigned int chunks, unsigned int lookups)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    double times[3];
+    int impl;
+    for (impl = 0; impl <= 1; impl++)
+      {
+        ctr_bench_chunk_dir (impl, chunks, lookups, times);
+        av_push (RETVAL, newSVpv (impl ? "chunk_dir" : "axis_arrays", 0));
+        av_push (RETVAL, newSVnv (times[0]));
+        av_push (RETVAL, newSVnv (times[1]));
+        av_push (RETVAL, newSVnv (times[2]));
+      }
+
+  OUTPUT:
+    RETVAL
+
+AV *ctr_bench_sector_scans (int sector_x, int sector_y, int sector_z, unsigned int iterations)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    double times[2];
+    ctr_bench_sector_scans (sector_x, sector_y, sector_z, iterations, times);
+    av_push (RETVAL, newSVnv (times[0]));
+    av_push (RETVAL, newSVnv (times[1]));
+
+  OUTPUT:
+    RETVAL
+
+AV *ctr_bench_region_scan (int sector_x, int sector_y, int sector_z, unsigned int iterations)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    double times[2];
+    ctr_bench_region_scan (sector_x, sector_y, sector_z, iterations, times);
+    av_push (RETVAL, newSVnv (times[0]));
+    av_push (RETVAL, newSVnv (times[1]));
+
+  OUTPUT:
+    RETVAL
+
+AV *ctr_bench_visibility (int sector_x, int sector_y, int sector_z, unsigned int iterations)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    double times[2];
+    int diff = ctr_bench_visibility (sector_x, sector_y, sector_z, iterations, times);
+    av_push (RETVAL, newSVnv (times[0]));
+    av_push (RETVAL, newSVnv (times[1]));
+    av_push (RETVAL, newSViv (diff));
+
+  OUTPUT:
+    RETVAL
+
+AV *ctr_bench_light_edits (int sector_x, int sector_y, int sector_z, unsigned int edits)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    double times[4];
+    int diff = ctr_bench_light_edits (sector_x, sector_y, sector_z, edits, times);
+    int i;
+    for (i = 0; i < 4; i++)
+      av_push (RETVAL, newSVnv (times[i]));
+    av_push (RETVAL, newSViv (diff));
+
+  OUTPUT:
+    RETVAL
+
+AV *ctr_bench_sector_light (int sector_x, int sector_y, int sector_z, unsigned int iterations)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    double times[2];
+    int diff = ctr_bench_sector_light (sector_x, sector_y, sector_z, iterations, times);
+    av_push (RETVAL, newSVnv (times[0]));
+    av_push (RETVAL, newSVnv (times[1]));
+    av_push (RETVAL, newSViv (diff));
+
+  OUTPUT:
+    RETVAL
+
+AV *ctr_bench_chunk_codec (unsigned int iterations)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    double gbs[2];
+    ctr_bench_chunk_codec (iterations, gbs);
+    av_push (RETVAL, newSVnv (gbs[0]));
+    av_push (RETVAL, newSVnv (gbs[1]));
+
+  OUTPUT:
+    RETVAL
+
+AV *ctr_bench_coord_math (int sector_x, int sector_y, int sector_z, unsigned int lookups)
+  CODE:
+    RETVAL = newAV ();
+    sv_2mortal ((SV *)RETVAL);
+
+    double times[2];
+    ctr_bench_coord_math (sector_x, sector_y, sector_z, lookups, times);
+    av_push (RETVAL, newSVnv (times[0]));
+    av_push (RETVAL, newSVnv (times[1]));
+
+  OUTPUT:
+    RETVAL
+
+#endif
 
 MODULE = Games::Construder PACKAGE = Games::Construder::Random PREFIX = random_
 
@@ -0,0 +1,849 @@
+/*
+ * Games::Construder - A 3D Game written in Perl with an infinite and modifiable world.
+ * Copyright (C) 2011  Robin Redeker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file contains micro benchmarks for the data structures and
+ * algorithms of the C core. They are run by scripts/benchmark and
+ * are not used by the game itself.
+ */
+#include <time.h>
+
+double ctr_bench_now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+/* Computes the coordinates of the n-th chunk in a cube of chunks around
+ * the origin. The cube is traversed sector wise, like the server loads them.
+ */
+void ctr_bench_chunk_coord (unsigned int n, unsigned int side, int *x, int *y, int *z)
+{
+  unsigned int sec_alen = CHUNKS_P_SECTOR * CHUNKS_P_SECTOR * CHUNKS_P_SECTOR;
+  unsigned int secs = (side + CHUNKS_P_SECTOR - 1) / CHUNKS_P_SECTOR;
+  unsigned int sec  = n / sec_alen,
+               offs = n % sec_alen;
+
+  *x = (sec % secs) * CHUNKS_P_SECTOR + offs % CHUNKS_P_SECTOR - side / 2;
+  *y = ((sec / secs) % secs) * CHUNKS_P_SECTOR
+       + (offs / CHUNKS_P_SECTOR) % CHUNKS_P_SECTOR - side / 2;
+  *z = (sec / (secs * secs)) * CHUNKS_P_SECTOR
+       + offs / (CHUNKS_P_SECTOR * CHUNKS_P_SECTOR) - side / 2;
+}
+
+// The nested y/x/z axis arrays, like the world used to store its chunks:
+void *ctr_bench_axis_get (ctr_axis_array *ya, int x, int y, int z)
+{
+  ctr_axis_array *xa = ctr_axis_get (ya, y);
+  if (!xa)
+    return 0;
+  ctr_axis_array *za = ctr_axis_get (xa, x);
+  if (!za)
+    return 0;
+  return ctr_axis_get (za, z);
+}
+
+void ctr_bench_axis_add (ctr_axis_array *ya, int x, int y, int z, void *ptr)
+{
+  ctr_axis_array *xa = ctr_axis_get (ya, y);
+  if (!xa)
+    {
+      xa = ctr_axis_array_new ();
+      ctr_axis_add (ya, y, xa);
+    }
+
+  ctr_axis_array *za = ctr_axis_get (xa, x);
+  if (!za)
+    {
+      za = ctr_axis_array_new ();
+      ctr_axis_add (xa, x, za);
+    }
+
+  ctr_axis_add (za, z, ptr);
+}
+
+void ctr_bench_axis_remove (ctr_axis_array *ya, int x, int y, int z)
+{
+  ctr_axis_array *xa = ctr_axis_get (ya, y);
+  if (!xa)
+    return;
+  ctr_axis_array *za = ctr_axis_get (xa, x);
+  if (!za)
+    return;
+
+  if (ctr_axis_remove (za, z) && ctr_axis_empty (za))
+    {
+      ctr_axis_remove (xa, x);
+      ctr_axis_array_free (za);
+
+      if (ctr_axis_empty (xa))
+        {
+          ctr_axis_remove (ya, y);
+          ctr_axis_array_free (xa);
+        }
+    }
+}
+
+/* Inserts, looks up and purges the given number of chunks in the axis
+ * arrays (impl == 0) or the chunk directory (impl == 1).
+ * The lookups mimic the renderer and light code: a chunk and its
+ * 6 neighbours, at the border of the loaded area some of them miss.
+ * Stores the nanoseconds per operation in times[3].
+ */
+void ctr_bench_chunk_dir (int impl, unsigned int chunks, unsigned int lookups, double *times)
+{
+  unsigned int side = 1;
+  while (side * side * side < chunks)
+    side++;
+  side = ((side + CHUNKS_P_SECTOR - 1) / CHUNKS_P_SECTOR) * CHUNKS_P_SECTOR;
+
+  ctr_axis_array *ya = 0;
+  ctr_chunk_dir dir;
+  if (impl)
+    ctr_chunk_dir_init (&dir);
+  else
+    ya = ctr_axis_array_new ();
+
+  unsigned int i;
+  int x, y, z;
+  double t = ctr_bench_now ();
+  for (i = 0; i < chunks; i++)
+    {
+      ctr_bench_chunk_coord (i, side, &x, &y, &z);
+      if (impl)
+        ctr_chunk_dir_add (&dir, x, y, z, (void *) (long) (i + 1));
+      else
+        ctr_bench_axis_add (ya, x, y, z, (void *) (long) (i + 1));
+    }
+  times[0] = ((ctr_bench_now () - t) * 1000000000.0) / chunks;
+
+  static int neighbours[7][3] = {
+    { 0, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 },
+    { -1, 0, 0 }, { 1, 0, 0 }, { 0, 0, -1 }, { 0, 0, 1 },
+  };
+
+  unsigned long found = 0;
+  unsigned int rnd = 42;
+  t = ctr_bench_now ();
+  for (i = 0; i < lookups; i += 7)
+    {
+      rnd = rnd_xor (rnd);
+      ctr_bench_chunk_coord (rnd % chunks, side, &x, &y, &z);
+
+      int n;
+      for (n = 0; n < 7; n++)
+        {
+          void *p =
+            impl ? ctr_chunk_dir_get (&dir, x + neighbours[n][0], y + neighbours[n][1], z + neighbours[n][2])
+                 : ctr_bench_axis_get (ya, x + neighbours[n][0], y + neighbours[n][1], z + neighbours[n][2]);
+          if (p)
+            found++;
+        }
+    }
+  times[1] = ((ctr_bench_now () - t) * 1000000000.0) / lookups;
+
+  t = ctr_bench_now ();
+  for (i = 0; i < chunks; i++)
+    {
+      ctr_bench_chunk_coord (i, side, &x, &y, &z);
+      if (impl)
+        ctr_chunk_dir_remove (&dir, x, y, z);
+      else
+        ctr_bench_axis_remove (ya, x, y, z);
+    }
+  times[2] = ((ctr_bench_now () - t) * 1000000000.0) / chunks;
+
+  if (impl)
+    {
+      assert (dir.len == 0);
+      ctr_chunk_dir_free (&dir);
+    }
+  else
+    {
+      assert (ctr_axis_empty (ya));
+      ctr_axis_array_free (ya);
+    }
+
+  assert (found > 0);
+}
+
+/* Runs the visibility pass over all chunks of the sector and searches
+ * the sector for lights, like the server does after loading a sector.
+ * Stores the best microseconds per sector of all iterations in times[2].
+ */
+void ctr_bench_sector_scans (int sx, int sy, int sz, unsigned int iterations, double *times)
+{
+  int cx = sx * CHUNKS_P_SECTOR,
+      cy = sy * CHUNKS_P_SECTOR,
+      cz = sz * CHUNKS_P_SECTOR;
+  unsigned int i;
+  int x, y, z;
+
+  times[0] = times[1] = -1;
+
+  AV *found = newAV ();
+  for (i = 0; i < iterations; i++)
+    {
+      double t = ctr_bench_now ();
+      for (z = cz; z < cz + CHUNKS_P_SECTOR; z++)
+        for (y = cy; y < cy + CHUNKS_P_SECTOR; y++)
+          for (x = cx; x < cx + CHUNKS_P_SECTOR; x++)
+            {
+              ctr_chunk *chnk = ctr_world_chunk (x, y, z, 0);
+              if (chnk)
+                ctr_world_chunk_calc_visibility (chnk);
+            }
+      t = (ctr_bench_now () - t) * 1000000.0;
+      if (times[0] < 0 || t < times[0])
+        times[0] = t;
+
+      t = ctr_bench_now ();
+      ctr_world_query_setup (
+        cx, cy, cz,
+        cx + CHUNKS_P_SECTOR - 1, cy + CHUNKS_P_SECTOR - 1, cz + CHUNKS_P_SECTOR - 1);
+      ctr_world_query_load_chunks (0);
+      ctr_world_query_search_types (35, 41, 40, found);
+      ctr_world_query_desetup (1);
+      t = (ctr_bench_now () - t) * 1000000.0;
+      if (times[1] < 0 || t < times[1])
+        times[1] = t;
+
+      av_clear (found);
+    }
+  SvREFCNT_dec (found);
+}
+
+/* Looks up random cells of the sector, once by their world coordinates
+ * and once through a query context, which is where the chunk size
+ * matters most. Stores the nanoseconds per lookup in times[2].
+ */
+void ctr_bench_coord_math (int sx, int sy, int sz, unsigned int lookups, double *times)
+{
+  int sec_size = CHUNKS_P_SECTOR * CHUNK_SIZE;
+  int ox = sx * sec_size,
+      oy = sy * sec_size,
+      oz = sz * sec_size;
+  unsigned int rnd = 42;
+  unsigned int i, sum = 0;
+
+#define BENCH_RND(r) ((r) ^= (r) << 13, (r) ^= (r) >> 17, (r) ^= (r) << 5, (r) % sec_size)
+
+  double t = ctr_bench_now ();
+  for (i = 0; i < lookups; i++)
+    {
+      double x = ox + BENCH_RND (rnd) + 0.5,
+             y = oy + BENCH_RND (rnd) + 0.5,
+             z = oz + BENCH_RND (rnd) + 0.5;
+      ctr_chunk *chnk = ctr_world_chunk_at (x, y, z, 0);
+      if (chnk)
+        sum += CELL_TYPE (chnk, ctr_chunk_offs_at_abs (x, y, z));
+    }
+  times[0] = ((ctr_bench_now () - t) * 1000000000.0) / lookups;
+
+  ctr_world_query_setup (
+    sx * CHUNKS_P_SECTOR, sy * CHUNKS_P_SECTOR, sz * CHUNKS_P_SECTOR,
+    sx * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1,
+    sy * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1,
+    sz * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1);
+  ctr_world_query_load_chunks (0);
+
+  t = ctr_bench_now ();
+  for (i = 0; i < lookups; i++)
+    {
+      int x = ox + BENCH_RND (rnd),
+          y = oy + BENCH_RND (rnd),
+          z = oz + BENCH_RND (rnd);
+      unsigned int offs;
+      ctr_world_query_abs2rel (&x, &y, &z);
+      ctr_chunk *chnk = ctr_world_query_cell_at (x, y, z, 0, &offs);
+      if (chnk)
+        sum += CELL_TYPE (chnk, offs);
+    }
+  times[1] = ((ctr_bench_now () - t) * 1000000000.0) / lookups;
+
+  ctr_world_query_desetup (1);
+#undef BENCH_RND
+
+  // keep the compiler from optimizing the lookups away:
+  if (sum == 0xFFFFFFFF)
+    printf ("%u\n", sum);
+}
+
+/* Counts the lights of a sector cell by cell, once with
+ * ctr_world_query_cell_at () and once with a query cursor. Stores the
+ * best microseconds per sector of all iterations in times[2].
+ */
+void ctr_bench_region_scan (int sx, int sy, int sz, unsigned int iterations, double *times)
+{
+  int size = CHUNKS_P_SECTOR * CHUNK_SIZE;
+  unsigned int i, cnt[2] = { 0, 0 };
+  int x, y, z;
+
+  ctr_world_query_setup (
+    sx * CHUNKS_P_SECTOR, sy * CHUNKS_P_SECTOR, sz * CHUNKS_P_SECTOR,
+    sx * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1,
+    sy * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1,
+    sz * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1);
+  ctr_world_query_load_chunks (0);
+
+  times[0] = times[1] = -1;
+  for (i = 0; i < iterations; i++)
+    {
+      double t = ctr_bench_now ();
+      cnt[0] = 0;
+      for (x = 0; x < size; x++)
+        for (y = 0; y < size; y++)
+          for (z = 0; z < size; z++)
+            {
+              unsigned int offs;
+              ctr_chunk *cur = ctr_world_query_cell_at (x, y, z, 0, &offs);
+              if (cur && (CELL_TYPE (cur, offs) == 35
+                          || CELL_TYPE (cur, offs) == 40
+                          || CELL_TYPE (cur, offs) == 41))
+                cnt[0]++;
+            }
+      t = (ctr_bench_now () - t) * 1000000.0;
+      if (times[0] < 0 || t < times[0])
+        times[0] = t;
+
+      t = ctr_bench_now ();
+      cnt[1] = 0;
+      ctr_world_query_cursor c;
+      ctr_world_query_cursor_init_all (&c, 0);
+      while (ctr_world_query_cursor_next (&c))
+        {
+          unsigned short *type = &(c.chnk->cells->type[c.offs]);
+          unsigned int j;
+          for (j = 0; j < c.len; j++)
+            cnt[1] += type[j] == 35 || type[j] == 40 || type[j] == 41;
+        }
+      t = (ctr_bench_now () - t) * 1000000.0;
+      if (times[1] < 0 || t < times[1])
+        times[1] = t;
+
+      assert (cnt[0] == cnt[1]);
+    }
+
+  ctr_world_query_desetup (1);
+}
+
+/* The visibility pass before it worked on bit rows: one byte per cell
+ * from the chunk halo, six neighbour tests per cell. Kept as the
+ * reference for ctr_bench_visibility ().
+ */
+static void ctr_bench_calc_visibility_bytes (ctr_chunk *chnk)
+{
+  memset (chnk->visible, 0, CHUNK_VIS_LEN);
+
+  ctr_chunk_summary (chnk);
+  if (chnk->nonair == 0 || ctr_chunk_buried (chnk))
+    return;
+
+  ctr_chunk_halo *h = ctr_chunk_halo_get (chnk, CTR_HALO_NEIGHBOURS);
+  unsigned char vis[CHUNK_SIZE];
+  int x, y, z;
+
+  for (z = 0; z < CHUNK_SIZE; z++)
+    for (y = 0; y < CHUNK_SIZE; y++)
+      {
+        unsigned char  *t = &(h->transparent[HALO_OFFS (0, y, z)]);
+        unsigned short *c = &(h->type[HALO_OFFS (0, y, z)]);
+        for (x = 0; x < CHUNK_SIZE; x++)
+          vis[x] =
+            (c[x] != 0)
+            & (  t[x - HALO_DX] | t[x + HALO_DX]
+               | t[x - HALO_DY] | t[x + HALO_DY]
+               | t[x - HALO_DZ] | t[x + HALO_DZ]);
+
+        unsigned int offs = REL_POS2OFFS (0, y, z);
+        for (x = 0; x < CHUNK_SIZE; x++, offs++)
+          if (vis[x])
+            CELL_SET_VISIBLE (chnk, offs, 1);
+      }
+
+  ctr_chunk_halo_put (h);
+}
+
+/* Runs the visibility pass over all chunks of the sector, once with the
+ * byte per cell reference and once with ctr_world_chunk_calc_visibility ().
+ * Stores the best microseconds per sector of all iterations in times[2],
+ * and returns the number of chunks whose visible bits differ.
+ */
+int ctr_bench_visibility (int sx, int sy, int sz, unsigned int iterations, double *times)
+{
+  static unsigned char ref[CHUNKS_P_SECTOR][CHUNKS_P_SECTOR][CHUNKS_P_SECTOR][CHUNK_VIS_LEN];
+  int cx = sx * CHUNKS_P_SECTOR,
+      cy = sy * CHUNKS_P_SECTOR,
+      cz = sz * CHUNKS_P_SECTOR;
+  unsigned int i;
+  int x, y, z, impl, diff = 0;
+
+  times[0] = times[1] = -1;
+  for (impl = 0; impl < 2; impl++)
+    for (i = 0; i < iterations; i++)
+      {
+        double t = ctr_bench_now ();
+        for (z = 0; z < CHUNKS_P_SECTOR; z++)
+          for (y = 0; y < CHUNKS_P_SECTOR; y++)
+            for (x = 0; x < CHUNKS_P_SECTOR; x++)
+              {
+                ctr_chunk *chnk = ctr_world_chunk (cx + x, cy + y, cz + z, 0);
+                if (!chnk)
+                  continue;
+                if (impl)
+                  ctr_world_chunk_calc_visibility (chnk);
+                else
+                  ctr_bench_calc_visibility_bytes (chnk);
+              }
+        t = (ctr_bench_now () - t) * 1000000.0;
+        if (times[impl] < 0 || t < times[impl])
+          times[impl] = t;
+      }
+
+  for (impl = 0; impl < 2; impl++)
+    for (z = 0; z < CHUNKS_P_SECTOR; z++)
+      for (y = 0; y < CHUNKS_P_SECTOR; y++)
+        for (x = 0; x < CHUNKS_P_SECTOR; x++)
+          {
+            ctr_chunk *chnk = ctr_world_chunk (cx + x, cy + y, cz + z, 0);
+            if (!chnk)
+              continue;
+            if (impl)
+              {
+                ctr_world_chunk_calc_visibility (chnk);
+                diff += memcmp (ref[z][y][x], chnk->visible, CHUNK_VIS_LEN) != 0;
+              }
+            else
+              {
+                ctr_bench_calc_visibility_bytes (chnk);
+                memcpy (ref[z][y][x], chnk->visible, CHUNK_VIS_LEN);
+              }
+          }
+
+  return diff;
+}
+
+// Maximum light level of the neighbours, for the reference below.
+static unsigned char ctr_bench_max_light_of_neighbours (int x, int y, int z)
+{
+  unsigned int ao, bo, lo, ro, fo, bko;
+  ctr_chunk *above = ctr_world_query_cell_at (x, y + 1, z, 0, &ao);
+  ctr_chunk *below = ctr_world_query_cell_at (x, y - 1, z, 0, &bo);
+  ctr_chunk *left  = ctr_world_query_cell_at (x - 1, y, z, 0, &lo);
+  ctr_chunk *right = ctr_world_query_cell_at (x + 1, y, z, 0, &ro);
+  ctr_chunk *front = ctr_world_query_cell_at (x, y, z - 1, 0, &fo);
+  ctr_chunk *back  = ctr_world_query_cell_at (x, y, z + 1, 0, &bko);
+  unsigned char l = 0;
+  if (above && CELL_LIGHT (above, ao)  > l) l = CELL_LIGHT (above, ao);
+  if (below && CELL_LIGHT (below, bo)  > l) l = CELL_LIGHT (below, bo);
+  if (left  && CELL_LIGHT (left, lo)   > l) l = CELL_LIGHT (left, lo);
+  if (right && CELL_LIGHT (right, ro)  > l) l = CELL_LIGHT (right, ro);
+  if (front && CELL_LIGHT (front, fo)  > l) l = CELL_LIGHT (front, fo);
+  if (back  && CELL_LIGHT (back, bko)  > l) l = CELL_LIGHT (back, bko);
+  return l;
+}
+
+/* The light algorithm before the two queue engine: flood fills the area
+ * the change can reach, darkens it and relights it from the neighbours
+ * until nothing changes anymore. Kept as the reference for
+ * ctr_bench_light_edits ().
+ */
+static void ctr_bench_reflow_light_fixpoint (int x, int y, int z)
+{
+  int query_w = QUERY_CONTEXT.x_w * CHUNK_SIZE;
+
+  ctr_world_light_upd_start ();
+  ctr_world_light_visited_clear ();
+
+  unsigned int offs;
+  ctr_chunk *cur = ctr_world_query_cell_at (x, y, z, 0, &offs);
+  if (!cur)
+    return;
+
+  /* First part of this function tries to find out what kind of
+   * light change should be recomputed.
+   */
+
+  unsigned char l = ctr_bench_max_light_of_neighbours (x, y, z);
+
+  if (ctr_world_cell_transparent (cur, offs)) // a transparent cell has changed
+    {
+      if (l > 0) l--;
+      if (CELL_LIGHT (cur, offs) < l)
+        {
+          ctr_world_light_enqueue (x, y, z, l);
+        }
+      else if (CELL_LIGHT (cur, offs) > l) // we are brighter then the neighbors
+        {
+          ctr_world_light_enqueue (x, y, z, CELL_LIGHT (cur, offs));
+        }
+      else // cur->light == l
+        {
+          // we are transparent and have the light we should have
+          // so we don't need to change anything.
+          // XXX: BUT: still force update :)
+          ctr_world_query_cell_at (x, y, z, 1, &offs);
+          return; // => no change, so no change for anyone else
+        }
+    }
+  else // oh, a (light) blocking cell has been set!
+    {
+      ctr_chunk *cur = ctr_world_query_cell_at (x, y, z, 1, &offs);
+      if (!cur)
+        return;
+
+      unsigned char *light = &(CELL_LIGHT (cur, offs));
+      if (CELL_TYPE (cur, offs) == 41) // was a light: light it!
+        *light = 8;
+      else if (CELL_TYPE (cur, offs) == 35) // was a light: light it!
+        *light = 12;
+      else if (CELL_TYPE (cur, offs) == 40) // was a light: light it!
+        *light = 15;
+      else // oh boy, we will become darker, we are a intransparent block!
+        *light = 0; // we are blocking light, so we are dark
+
+      // if we are brighter than our neighbours, set our
+      // light value are update radius
+      if (*light > l)
+        l = *light;
+      ctr_world_light_enqueue_neighbours (x, y, z, l);
+    }
+
+  /* The following loop tries to find the affected area by flood filling it.
+   * While doing that it will compute the queue used in the next loops.
+   */
+  unsigned char upd_radius = 0;
+  while (ctr_world_light_dequeue (&x, &y, &z, &upd_radius))
+    {
+      // leave a margin, so we can reflow light from the outside...
+      if (x <= 0 || y <= 0 || z <= 0
+          || x >= (query_w - 1)
+          || y >= (query_w - 1)
+          || z >= (query_w - 1))
+        continue;
+
+      cur = ctr_world_query_cell_at (x, y, z, 0, &offs);
+      if (!cur || !ctr_world_cell_transparent (cur, offs)
+          || ctr_world_light_visit (x, y, z))
+        continue; // ignore blocks that can't be lit or were already visited
+
+      cur = ctr_world_query_cell_at (x, y, z, 1, &offs);
+      assert (cur);
+
+      CELL_LIGHT (cur, offs) = 0; // darken, it's relit below
+      ctr_world_light_select_queue (1);
+      ctr_world_light_enqueue (x, y, z, 1);
+      ctr_world_light_select_queue (0);
+      if (upd_radius > 0)
+        ctr_world_light_enqueue_neighbours (x, y, z, upd_radius - 1);
+    }
+
+  ctr_world_light_select_queue (1);
+  ctr_world_light_freeze_queue ();
+
+  /* Now we iterate over the working set in the queue and
+   * compute the light from the neighbors.
+   */
+  int change = 1;
+  while (change)
+    {
+      change = 0;
+      ctr_world_light_thaw_queue ();
+      // recompute light for every cell in the queue
+      while (ctr_world_light_dequeue (&x, &y, &z, &upd_radius))
+        {
+          cur = ctr_world_query_cell_at (x, y, z, 0, &offs);
+          if (!cur)
+            continue;
+
+          unsigned char l = ctr_bench_max_light_of_neighbours (x, y, z);
+          if (l > 0) l--;
+          // if the current cell is too dark, relight it
+          if (CELL_LIGHT (cur, offs) < l)
+            {
+              cur = ctr_world_query_cell_at (x, y, z, 1, &offs);
+              assert (cur);
+
+              CELL_LIGHT (cur, offs) = l;
+              change = 1;
+            }
+        }
+    }
+}
+
+/* Copies the light of all chunks of the query context to or from buf
+ * (CHUNK_ALEN bytes per chunk). With cmp set it returns the number of
+ * chunks whose light differs from buf instead.
+ */
+static int ctr_bench_light_snapshot (unsigned char *buf, int restore, int cmp)
+{
+  int i, diff = 0,
+      len = QUERY_CONTEXT.x_w * QUERY_CONTEXT.y_w * QUERY_CONTEXT.z_w;
+
+  for (i = 0; i < len; i++, buf += CHUNK_ALEN)
+    {
+      ctr_chunk *chnk = QUERY_CONTEXT.chunks[i];
+      if (!chnk)
+        continue;
+      if (chnk->packed)
+        ctr_chunk_unpack (chnk);
+
+      if (cmp)
+        diff += memcmp (buf, chnk->cells->light, CHUNK_ALEN) != 0;
+      else if (restore)
+        {
+          ctr_chunk_cell_changed (chnk, 0);
+          memcpy (chnk->cells->light, buf, CHUNK_ALEN);
+        }
+      else
+        memcpy (buf, chnk->cells->light, CHUNK_ALEN);
+    }
+
+  return diff;
+}
+
+/* Places edits lights (cycling through the types 41, 35 and 40) at random
+ * cells of the (already lit) sector and removes them again in reverse
+ * order, relighting after every edit like the server does. This is done
+ * once with the fix point reference and once with
+ * ctr_world_query_reflow_light (), both starting from the same light.
+ * Stores the mean microseconds per edit in times[4] (reference place and
+ * remove, engine place and remove) and returns the number of chunks
+ * whose light differs between both after placing and after removing.
+ */
+int ctr_bench_light_edits (int sx, int sy, int sz, unsigned int edits, double *times)
+{
+  int size = CHUNKS_P_SECTOR * CHUNK_SIZE;
+  unsigned int len = CHUNKS_P_SECTOR * CHUNKS_P_SECTOR * CHUNKS_P_SECTOR * CHUNK_ALEN;
+  unsigned char *start = safemalloc (len),
+                *placed = safemalloc (len),
+                *removed = safemalloc (len);
+  int *pos = safemalloc (sizeof (int) * 4 * edits);
+  static const unsigned short types[3] = { 41, 35, 40 };
+  unsigned int i, rnd = 42;
+  int impl, diff = 0;
+
+  ctr_world_query_setup (
+    sx * CHUNKS_P_SECTOR, sy * CHUNKS_P_SECTOR, sz * CHUNKS_P_SECTOR,
+    sx * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1,
+    sy * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1,
+    sz * CHUNKS_P_SECTOR + CHUNKS_P_SECTOR - 1);
+  ctr_world_query_load_chunks (0);
+  ctr_bench_light_snapshot (start, 0, 0);
+
+  for (i = 0; i < edits * 3; i++)
+    {
+      rnd = rnd_xor (rnd);
+      pos[i] = 1 + rnd % (size - 2);
+    }
+
+  for (impl = 0; impl < 2; impl++)
+    {
+      double t;
+      int j;
+
+      ctr_bench_light_snapshot (start, 1, 0);
+
+      t = ctr_bench_now ();
+      for (i = 0; i < edits; i++)
+        {
+          int *p = &(pos[i * 3]);
+          unsigned int offs;
+          ctr_chunk *cur = ctr_world_query_cell_at (p[0], p[1], p[2], 1, &offs);
+          if (!cur)
+            continue;
+
+          // remember the old type behind the positions:
+          pos[edits * 3 + i] = CELL_TYPE (cur, offs);
+          CELL_TYPE (cur, offs)  = types[i % 3];
+          CELL_LIGHT (cur, offs) = 0;
+          ctr_chunk_type_changed (cur, offs, pos[edits * 3 + i], types[i % 3]);
+
+          if (impl)
+            ctr_world_query_reflow_light (p[0], p[1], p[2]);
+          else
+            ctr_bench_reflow_light_fixpoint (p[0], p[1], p[2]);
+        }
+      times[impl * 2] = (ctr_bench_now () - t) * 1000000.0 / edits;
+
+      if (impl)
+        diff += ctr_bench_light_snapshot (placed, 0, 1);
+      else
+        ctr_bench_light_snapshot (placed, 0, 0);
+
+      t = ctr_bench_now ();
+      for (j = edits - 1; j >= 0; j--)
+        {
+          int *p = &(pos[j * 3]);
+          unsigned int offs;
+          ctr_chunk *cur = ctr_world_query_cell_at (p[0], p[1], p[2], 1, &offs);
+          if (!cur)
+            continue;
+
+          unsigned short otype = CELL_TYPE (cur, offs);
+          CELL_TYPE (cur, offs) = pos[edits * 3 + j];
+          ctr_chunk_type_changed (cur, offs, otype, pos[edits * 3 + j]);
+
+          if (impl)
+            ctr_world_query_reflow_light (p[0], p[1], p[2]);
+          else
+            ctr_bench_reflow_light_fixpoint (p[0], p[1], p[2]);
+        }
+      times[impl * 2 + 1] = (ctr_bench_now () - t) * 1000000.0 / edits;
+
+      if (impl)
+        diff += ctr_bench_light_snapshot (removed, 0, 1);
+      else
+        ctr_bench_light_snapshot (removed, 0, 0);
+    }
+
+  ctr_world_query_desetup (1);
+
+  safefree (pos);
+  safefree (removed);
+  safefree (placed);
+  safefree (start);
+
+  return diff;
+}
+
+/* Lights the sector once light by light with ctr_world_query_reflow_light
+ * (), like the server did when it created or loaded a sector, and once
+ * with ctr_world_query_relight_box (), both starting from the same light
+ * in a context with two chunks around the sector (see
+ * World::flow_light_query_setup). Stores the best microseconds of all
+ * iterations in times[2] and returns the number of chunks whose light
+ * differs between both.
+ */
+int ctr_bench_sector_light (int sx, int sy, int sz, unsigned int iterations, double *times)
+{
+  int cx = sx * CHUNKS_P_SECTOR,
+      cy = sy * CHUNKS_P_SECTOR,
+      cz = sz * CHUNKS_P_SECTOR;
+  ctr_world_query_setup (
+    cx - 2, cy - 2, cz - 2,
+    cx + CHUNKS_P_SECTOR + 2, cy + CHUNKS_P_SECTOR + 2, cz + CHUNKS_P_SECTOR + 2);
+  ctr_world_query_load_chunks (0);
+
+  unsigned int len =
+    QUERY_CONTEXT.x_w * QUERY_CONTEXT.y_w * QUERY_CONTEXT.z_w * CHUNK_ALEN;
+  unsigned char *start = safemalloc (len),
+                *lit = safemalloc (len);
+  ctr_bench_light_snapshot (start, 0, 0);
+
+  unsigned int i, j;
+  int impl, x, y, z, diff;
+
+  times[0] = times[1] = -1;
+  for (impl = 0; impl < 2; impl++)
+    for (i = 0; i < iterations; i++)
+      {
+        ctr_bench_light_snapshot (start, 1, 0);
+
+        double t = ctr_bench_now ();
+        if (impl)
+          ctr_world_query_relight_box (
+            2 * CHUNK_SIZE, 2 * CHUNK_SIZE, 2 * CHUNK_SIZE,
+            (2 + CHUNKS_P_SECTOR) * CHUNK_SIZE - 1,
+            (2 + CHUNKS_P_SECTOR) * CHUNK_SIZE - 1,
+            (2 + CHUNKS_P_SECTOR) * CHUNK_SIZE - 1);
+        else
+          for (z = 2; z < 2 + CHUNKS_P_SECTOR; z++)
+            for (y = 2; y < 2 + CHUNKS_P_SECTOR; y++)
+              for (x = 2; x < 2 + CHUNKS_P_SECTOR; x++)
+                {
+                  ctr_chunk *chnk = QUERY_CHUNK(x, y, z);
+                  if (!chnk)
+                    continue;
+
+                  unsigned short *special = ctr_chunk_special (chnk);
+                  for (j = 0; j < chnk->special_len; j++)
+                    {
+                      unsigned int offs = special[j];
+                      if (CTR_IS_LIGHT_TYPE (CELL_TYPE (chnk, offs)))
+                        ctr_world_query_reflow_light (
+                          x * CHUNK_SIZE + offs % CHUNK_SIZE,
+                          y * CHUNK_SIZE + (offs / CHUNK_SIZE) % CHUNK_SIZE,
+                          z * CHUNK_SIZE + offs / (CHUNK_SIZE * CHUNK_SIZE));
+                    }
+                }
+        t = (ctr_bench_now () - t) * 1000000.0;
+        if (times[impl] < 0 || t < times[impl])
+          times[impl] = t;
+
+        if (i == 0 && !impl)
+          ctr_bench_light_snapshot (lit, 0, 0);
+      }
+
+  diff = ctr_bench_light_snapshot (lit, 0, 1);
+  ctr_world_query_desetup (1);
+
+  safefree (lit);
+  safefree (start);
+
+  return diff;
+}
+
+/* Encodes and decodes a chunk with random cells to and from the chunk
+ * data format. Stores the throughput in GB/s of the chunk data in gbs[2]
+ * (encoding, decoding).
+ */
+void ctr_bench_chunk_codec (unsigned int iterations, double *gbs)
+{
+  ctr_chunk chnk;
+  memset (&chnk, 0, sizeof (chnk));
+  chnk.cells = safemalloc (sizeof (ctr_chunk_cells));
+  memset (chnk.cells, 0, sizeof (ctr_chunk_cells));
+
+  unsigned char *data = safemalloc (CHUNK_DATA_LEN);
+  unsigned int rnd = 42;
+  unsigned int i;
+  for (i = 0; i < CHUNK_ALEN; i++)
+    {
+      rnd = rnd_xor (rnd);
+      chnk.cells->type[i]  = rnd % 4096;
+      chnk.cells->light[i] = (rnd >> 12) & 0x0F;
+      chnk.cells->meta[i]  = rnd >> 16;
+      chnk.cells->add[i]   = rnd >> 24;
+    }
+
+  unsigned int sum = 0;
+  double t = ctr_bench_now ();
+  for (i = 0; i < iterations; i++)
+    {
+      ctr_world_get_chunk_data (&chnk, data);
+      sum += data[i % CHUNK_DATA_LEN];
+    }
+  gbs[0] = ((double) iterations * CHUNK_DATA_LEN) / (ctr_bench_now () - t) / 1e9;
+
+  t = ctr_bench_now ();
+  for (i = 0; i < iterations; i++)
+    {
+      data[i % CHUNK_DATA_LEN] ^= 1; // make every round change something
+      sum += ctr_world_set_chunk_from_data (&chnk, data, CHUNK_DATA_LEN);
+    }
+  gbs[1] = ((double) iterations * CHUNK_DATA_LEN) / (ctr_bench_now () - t) / 1e9;
+
+  safefree (data);
+  safefree (chnk.cells);
+  if (chnk.special)
+    safefree (chnk.special);
+
+  // keep the compiler from optimizing the loops away:
+  if (sum == 0xFFFFFFFF)
+    printf ("%u\n", sum);
+}
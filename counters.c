@@ -1,3 +1,5 @@
+#include <time.h>
+
 typedef struct _ctr_prof_counters {
     int chunk_changes;
     int active_cell_changes;
@@ -9,11 +11,106 @@ typedef struct _ctr_prof_counters {
     int dyn_buf_size;
     int geom_cnt;
     int allocated_chunks;
+    int chunk_dir_size;
+    int packed_chunks;
+    int packed_chunks_size;
+    int shared_chunks;   // chunks that share their cells with another one
+    // in bytes, like the sizes in slab.c:
+    unsigned long slab_live;       // handed out by the slabs
+    unsigned long slab_free;       // reserved by the slabs, but not handed out
+    unsigned long slab_high_water; // maximum of slab_live
+    unsigned long slab_reserved;   // all slab pages
 } ctr_prof_counters;
 
 static ctr_prof_counters ctr_prof_cnt;
 
+/* Timers for the hot operations. Every timer counts the calls, sums up
+ * the time of the timed ones and keeps a histogram of their durations:
+ * bucket i holds the calls that took [2^i, 2^(i+1)) nanoseconds, the last
+ * bucket everything longer.
+ */
+#define CTR_PROF_BUCKETS 32
+
+enum ctr_prof_timer_id {
+  CTR_PROF_CHUNK_LOOKUP,
+  CTR_PROF_MESH,
+  CTR_PROF_VISIBILITY,
+  CTR_PROF_LIGHT,
+  CTR_PROF_VOL_DRAW,
+  CTR_PROF_ENCODE,
+  CTR_PROF_DECODE,
+  CTR_PROF_SECTOR_IMPORT,
+  CTR_PROF_SECTOR_EXPORT,
+  CTR_PROF_TIMERS
+};
+
+static const char *ctr_prof_timer_names[CTR_PROF_TIMERS] = {
+  "chunk_lookup",
+  "mesh",
+  "visibility",
+  "light",
+  "vol_draw",
+  "chunk_encode",
+  "chunk_decode",
+  "sector_import",
+  "sector_export",
+};
+
+// Only every 2^n-th chunk lookup is timed, reading the clock costs
+// about as much as the lookup itself.
+#define CTR_PROF_LOOKUP_SAMPLE 63
+
+typedef struct _ctr_prof_timer {
+    unsigned long long calls;
+    unsigned long long timed;     // calls that were timed
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned int       hist[CTR_PROF_BUCKETS];
+} ctr_prof_timer;
+
+static ctr_prof_timer ctr_prof_tmr[CTR_PROF_TIMERS];
+
+static inline unsigned long long ctr_prof_now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void ctr_prof_record (int timer, unsigned long long ns)
+{
+  ctr_prof_timer *t = &ctr_prof_tmr[timer];
+  t->timed++;
+  t->total_ns += ns;
+  if (ns > t->max_ns)
+    t->max_ns = ns;
+
+  int b = 0;
+  while ((ns >>= 1) && b < CTR_PROF_BUCKETS - 1)
+    b++;
+  t->hist[b]++;
+}
+
+#define CTR_PROF_BEGIN(var) unsigned long long var = ctr_prof_now ()
+#define CTR_PROF_END(timer, var) \
+  do { \
+    ctr_prof_tmr[timer].calls++; \
+    ctr_prof_record ((timer), ctr_prof_now () - (var)); \
+  } while (0)
+
+/* Clears the timers and the event counters. The gauges describe the
+ * current state and are kept, the high water mark starts over.
+ */
+void ctr_prof_reset ()
+{
+  memset (ctr_prof_tmr, 0, sizeof (ctr_prof_tmr));
+  ctr_prof_cnt.chunk_changes       = 0;
+  ctr_prof_cnt.active_cell_changes = 0;
+  ctr_prof_cnt.slab_high_water     = ctr_prof_cnt.slab_live;
+}
+
 void ctr_prof_init ()
 {
   memset (&ctr_prof_cnt, 0, sizeof (ctr_prof_counters));
+  memset (ctr_prof_tmr, 0, sizeof (ctr_prof_tmr));
 }
@@ -292,29 +292,47 @@ our $SHELL;
 
 our $PROF_TMR;
 
-our @CCNT_NAMES = qw/
-   chunk_changes
-   active_cell_changes
-   allocated_axises
-   allocated_axises_size
-   noise_cnt
-   noise_size
-   dyn_buf_cnt
-   dyn_buf_size
-   geom_cnt
-   allocated_chunks
-/;
+# Returns the upper bound of the histogram bucket (in ns) that holds
+# the $p quantile of the calls of a timer from get_prof_counters.
+sub prof_quantile {
+   my ($tmr, $p) = @_;
+   my $want = $tmr->{timed} * $p;
+   my $sum = 0;
+   for (0..$#{$tmr->{hist}}) {
+      $sum += $tmr->{hist}->[$_];
+      return 2 ** ($_ + 1) if $sum >= $want;
+   }
+   $tmr->{max_ns}
+}
 
 sub init {
    my ($name) = @_;
 
    $PROF_TMR = AE::timer 60, 60, sub {
-      my $c_cntrs = Games::Construder::World::get_prof_counters ();
+      # reset after each snapshot, so every log covers the last interval
+      my $prof = Games::Construder::World::get_prof_counters (1);
+      my $c = $prof->{counters};
       ctr_log (memory_prof => "C Counters:");
-      my @names = @CCNT_NAMES;
-      for (@$c_cntrs) {
-         my $name = shift @names;
-         ctr_log (memory_prof => "   %20s: %d", $name, $_);
+      for (sort keys %$c) {
+         ctr_log (memory_prof => "   %20s: %d", $_, $c->{$_});
+      }
+      if ($c->{packed_chunks}) {
+         ctr_log (memory_prof => "   %20s: %d", "bytes/packed chunk",
+                  $c->{packed_chunks_size} / $c->{packed_chunks});
+      }
+
+      ctr_log (memory_prof => "C Timers (us):");
+      my $t = $prof->{timers};
+      for (sort keys %$t) {
+         my $tmr = $t->{$_};
+         next unless $tmr->{timed};
+         ctr_log (memory_prof =>
+            "   %20s: %d calls, avg %.1f, p50 < %.1f, p99 < %.1f, max %.1f",
+            $_, $tmr->{calls},
+            $tmr->{total_ns} / $tmr->{timed} / 1000,
+            prof_quantile ($tmr, 0.5) / 1000,
+            prof_quantile ($tmr, 0.99) / 1000,
+            $tmr->{max_ns} / 1000);
       }
    };
 
@@ -186,6 +186,14 @@ sub handle_packet : event_cb {
    ctr_log (network => "recv[%d]> %s: %s", length ($body), $hdr->{cmd}, join (',', keys %$hdr));
 
    if ($hdr->{cmd} eq 'hello') {
+      my $chunk_size = $hdr->{info}->{chunk_size} || 12;
+      if ($chunk_size != Games::Construder::World::chunk_size ()) {
+         $self->{front}->msg (
+            "Server uses chunk size $chunk_size, but this client was built with "
+            . Games::Construder::World::chunk_size () . "!");
+         return;
+      }
+
       $self->{front}->{server_info} = $hdr->{info};
       $self->{front}->msg ("Queried Resources");
       $self->send_server ({ cmd => 'list_resources' });
@@ -1462,7 +1462,7 @@ sub visibility_radius : event_cb {
    my ($self, $radius) = @_;
    $radius = 6 if $radius > 6; # limit, or it usuall kills server :-/
    $PL_VIS_RAD = $radius;
-   $FAR_PLANE = ($radius * 12) * 0.7;
+   $FAR_PLANE = ($radius * $Games::Construder::Client::World::CHNK_SIZE) * 0.7;
    glFogf (GL_FOG_START, $FAR_PLANE - 20);
    glFogf (GL_FOG_END,   $FAR_PLANE - 1);
    ctr_log (info => "changed visibility radius to %d", $PL_VIS_RAD);
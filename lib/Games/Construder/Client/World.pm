@@ -52,7 +52,7 @@ Games::Construder::Client::World - Client collision detection and world utilitie
 
 =cut
 
-our $CHNK_SIZE = 12;
+our $CHNK_SIZE = Games::Construder::World::chunk_size ();
 our $BSPHERE   = sqrt (3 * (($CHNK_SIZE/2) ** 2));
 my @CHUNKS;
 
@@ -282,6 +282,7 @@ sub handle_packet : event_cb {
            info => {
               version => (sprintf "G::C::Server %s", $Games::Construder::VERSION),
               credits => $RES->credits,
+              chunk_size => Games::Construder::World::chunk_size (),
            }
          });
 
@@ -451,7 +451,7 @@ sub drone_check_player_hit {
    }
 
    if (vlength (vsub ($pl->{data}->{pos}, $pos)) <= 1.1) {
-      my $dist = $entity->{teleport_dist} * 60;
+      my $dist = $entity->{teleport_dist} * $Games::Construder::Server::World::SEC_SIZE;
       my ($new_pl_pos, $dist, $secdist) =
          world_find_random_teleport_destination_at_dist ($pl->{data}->{pos}, $dist);
       $dist = int $dist;
@@ -868,7 +868,8 @@ sub tmr_jumper {
          }
 
          $pl->teleport (
-            vadd ($pl->{data}->{pos}, vsmul ($displ, 60)),
+            vadd ($pl->{data}->{pos},
+                  vsmul ($displ, $Games::Construder::Server::World::SEC_SIZE)),
             1
          );
          $pl->msg (0, "Jumper displaces you by @$displ sectors..."
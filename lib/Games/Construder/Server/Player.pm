@@ -85,7 +85,8 @@ sub _initialize_player {
       score     => 0,
  #     pos       => [1.1 * 60, -29 * 60, 1.1 * 60],
       pos       => [
-         map { 60 * $_ } $Games::Construder::Server::RES->get_initial_position
+         map { $Games::Construder::Server::World::SEC_SIZE * $_ }
+            $Games::Construder::Server::RES->get_initial_position
       ],
       time      => 0,
       inv       => $inv,
@@ -471,6 +472,7 @@ sub set_visible_chunks {
    for (@$old) {
       my $id = world_pos2id ($_);
       delete $self->{visible_chunk_ids}->{$id};
+      delete $self->{sent_versions}->{$id};
    }
 
    for (@$new) {
@@ -478,8 +480,11 @@ sub set_visible_chunks {
       $self->{visible_chunk_ids}->{$id} = $_;
    }
 
+   # requested chunks are always sent, the client doesn't have them:
    for (@{$req || []}) {
-      $self->{to_send_chunks}->{world_pos2id ($_)} = $_;
+      my $id = world_pos2id ($_);
+      $self->{to_send_chunks}->{$id} = $_;
+      delete $self->{sent_versions}->{$id};
    }
 
 }
@@ -517,6 +522,7 @@ sub chunk_updated {
       if ($self->{sent_chunks}->{$id}) {
          $self->send_client ({ cmd => "dirty_chunks", chnks => [$chnk] });
          delete $self->{sent_chunks}->{$id};
+         delete $self->{sent_versions}->{$id};
       }
    }
    #delete $self->{chunk_uptodate}->{world_pos2id ($chnk)};
@@ -557,18 +563,22 @@ sub send_chunk {
    # be sent by the chunk_changed-callback by the server (when it checks
    # whether any player might be interested in that chunk).
    my $id = world_pos2id ($chnk);
-   my $data = Games::Construder::World::get_chunk_data (@$chnk);
-   unless (defined $data) {
+   my ($version, $buf) = world_chunk_payload ($chnk);
+   unless (defined $version) {
       #d# warn "send_chunk: @$chnk was not yet allocated!\n";
       delete $self->{to_send_chunks}->{$id};
       return;
    }
 
-   my $buf = compress ($data);
+   delete $self->{to_send_chunks}->{$id};
+
+   # the client already got this version of the chunk:
+   return if defined $self->{sent_versions}->{$id}
+             && $self->{sent_versions}->{$id} == $version;
 
    $self->send_client ({ cmd => "chunk", pos => $chnk }, \$buf);
    $self->{sent_chunks}->{$id} = $chnk;
-   delete $self->{to_send_chunks}->{$id};
+   $self->{sent_versions}->{$id} = $version;
 }
 
 sub msg {
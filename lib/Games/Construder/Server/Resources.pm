@@ -803,7 +803,7 @@ sub get_assignment_for_score {
    # calculate distance of assignment
    $distance = lerp ($abal->{min_distance}, $abal->{max_distance}, $level);
    $time += $distance * $abal->{time_per_pos};
-   $distance *= 60;
+   $distance *= $Games::Construder::Server::World::SEC_SIZE;
    warn "time after distance: $time\n";
 
    # include the time factor for high levels
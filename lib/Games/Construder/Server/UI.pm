@@ -1244,7 +1244,8 @@ sub teleport {
    if ($self->{nav_to_pos}) {
       $self->{pl}->teleport ($self->{nav_to_pos});
    } else {
-      $self->{pl}->teleport (vsmul ($self->{nav_to_sector}, 60));
+      $self->{pl}->teleport (
+         vsmul ($self->{nav_to_sector}, $Games::Construder::Server::World::SEC_SIZE));
    }
 }
 
@@ -47,6 +47,7 @@ our @EXPORT = qw/
    world_load_around_at
    world_save_all
    world_find_random_teleport_destination_at_dist
+   world_chunk_payload
 /;
 
 
@@ -58,8 +59,10 @@ Games::Construder::Server::World - Server side world management and utility func
 
 =cut
 
-our $CHNK_SIZE = 12;
-our $CHNKS_P_SEC = 5;
+# chunk size is chosen when the C core is compiled, see Makefile.PL
+our $CHNK_SIZE   = Games::Construder::World::chunk_size ();
+our $CHNKS_P_SEC = Games::Construder::World::chunks_per_sector ();
+our $SEC_SIZE    = $CHNK_SIZE * $CHNKS_P_SEC;
 
 our $REGION_SEED = 42;
 our $REGION_SIZE = 100; # 100x100x100 sections
@@ -72,8 +75,38 @@ our $FREE_TMR;
 our $TICK_TMR;
 our @SAVE_SECTORS_QUEUE;
 
-our @LIGHTQUEUE;
-our %LIGHTQUEUE;
+# chunks that were not touched for this many ticks (0.15 seconds each)
+# are stored packed in memory:
+our $PACK_CHUNKS_AFTER = 400;
+
+# maximum memory in MB the C core may use for chunks, 0 means unlimited.
+# Exceeding it is fatal, so leave some headroom.
+our $MEMORY_BUDGET = $ENV{PERL_GAMES_CONSTRUDER_MEMORY_BUDGET} || 0;
+our $HUGE_PAGES    = $ENV{PERL_GAMES_CONSTRUDER_HUGE_PAGES}    || 0;
+
+# threads that light created and loaded sectors, 0 lights them right away
+# in the event loop:
+our $LIGHT_WORKERS =
+   defined $ENV{PERL_GAMES_CONSTRUDER_LIGHT_WORKERS}
+      ? $ENV{PERL_GAMES_CONSTRUDER_LIGHT_WORKERS} : 2;
+our $LIGHT_JOBS_W;
+
+# the version of the light rules (see light.c), the light of sectors that
+# were saved with other rules is computed again when they are loaded:
+our $LIGHT_VERSION = 1;
+# light reaches this many cells far, at most:
+our $LIGHT_REACH = 15;
+
+# sectors that were saved while their light job was still running, by id.
+# They are saved again with their light stamp when the job is done:
+our %LIGHT_UNSTAMPED;
+
+# versions (see Games::Construder::World::get_chunk_versions) of the
+# chunks as they were last saved or loaded, by chunk id:
+our %SAVED_VERSIONS;
+
+# compressed chunk data for the network, by chunk id: [version, data]
+our %CHUNK_PAYLOAD;
 
 our $SRV;
 
@@ -82,63 +115,92 @@ our $SRV;
 our $in_mutate;
 our @mutate_cont;
 
+# query contexts (see Games::Construder::World::query_new) for mutations
+# and sector creation/loading, so that none of them clobbers a query
+# the other one has set up:
+our $MUTATE_QUERY;
+our $SECTOR_QUERY;
+
 sub world_init {
    my ($server, $region_cmds) = @_;
 
    $SRV = $server;
 
+   Games::Construder::World::set_memory_budget (
+      $MEMORY_BUDGET * 1024 * 1024, $HUGE_PAGES);
+   # only the client renders, it computes the visibility of the cells itself:
+   Games::Construder::World::set_visibility (0);
+   $MUTATE_QUERY = Games::Construder::World::query_new ();
+   $SECTOR_QUERY = Games::Construder::World::query_new ();
+   # the callbacks get all changes of a query at once, as flat arrays:
    Games::Construder::World::init (
       sub {
-         my ($x, $y, $z) = @_;
-         my $chnk = [$x, $y, $z];
-
-         my $sec = world_chnkpos2secpos ($chnk);
-         my $id  = world_pos2id ($sec);
-         unless (exists $SECTORS{$id}) {
-            # this might happen either due to bugs or when sectors are loaded
-            # and light is calculated.
-#            warn "updated sector which is not loaded "
-#                 . "(chunk $x,$y,$z [@$sec]) $id. "
-#                 . "but this should be okay :-)\n";
-            return; # don't set dirty
+         my ($chunks) = @_;
+
+         my @chunks;
+         while (@$chunks) {
+            push @chunks, [splice @$chunks, 0, 3];
          }
-         world_sector_dirty ($sec);
 
-         for (values %{$server->{players}}) {
-            $_->chunk_updated ($chnk);
+         my $versions =
+            Games::Construder::World::get_chunk_versions ([map { @$_ } @chunks]);
+
+         for my $chnk (@chunks) {
+            my $version = shift @$versions;
+
+            my $sec = world_chnkpos2secpos ($chnk);
+            my $id  = world_pos2id ($sec);
+            unless (exists $SECTORS{$id}) {
+               # this might happen either due to bugs or when sectors are loaded
+               # and light is calculated.
+#               warn "updated sector which is not loaded "
+#                    . "(chunk @$chnk [@$sec]) $id. "
+#                    . "but this should be okay :-)\n";
+               next; # don't set dirty
+            }
+
+            # forced updates (eg. after loading) don't change the chunk:
+            my $cid = world_pos2id ($chnk);
+            unless (defined $version && defined $SAVED_VERSIONS{$cid}
+                    && $SAVED_VERSIONS{$cid} == $version) {
+               world_sector_dirty ($sec);
+            }
+
+            for (values %{$server->{players}}) {
+               $_->chunk_updated ($chnk);
+            }
          }
       },
       sub {
-         my ($x, $y, $z, $type, $ent) = @_;
-         ctr_log (debug => "change active cell: %d (%d,%d,%d) (%s)",
-                  $type, $x, $y, $z, $ent);
-         my $sec = world_chnkpos2secpos (world_pos2chnkpos ([$x, $y, $z]));
-         my $id  = world_pos2id ($sec);
-         return unless exists $SECTORS{$id};
-         my $eid = world_pos2id ([$x, $y, $z]);
-
-         my $e = delete $SECTORS{$id}->{entities}->{$eid};
-         if ($e) {
-            ctr_log (debug => "entity %s destroy at sector %s entid %s",
-                     $e, $id, $eid);
-            Games::Construder::Server::Objects::destroy ($e);
-         }
-
-         unless ($ent) {
-            $ent = Games::Construder::Server::Objects::instance ($type);
-            ctr_log (debug => "instance entity %s at sector %s type %s: %s",
-                     $eid, $id, $type, $ent);
-         } else {
-            ctr_log (debug => "put entity %s at sector %s type %s: %s",
-                     $eid, $id, $type, $ent);
+         my ($cells) = @_;
+         while (@$cells) {
+            _world_active_cell_changed (splice @$cells, 0, 5);
          }
-
-         $SECTORS{$id}->{entities}->{$eid} = $ent if $ent;
       }
    );
 
    Games::Construder::VolDraw::init ();
 
+   my $light_fd = Games::Construder::World::light_workers ($LIGHT_WORKERS);
+   if ($light_fd >= 0) {
+      open my $fh, "<&=", $light_fd
+         or die "couldn't open light job pipe: $!\n";
+      $LIGHT_JOBS_W = AE::io $fh, 0, sub {
+         my $cnt = Games::Construder::World::light_jobs_commit ();
+         return unless $cnt;
+
+         ctr_log (debug => "committed %d light jobs, %d to go",
+                  $cnt, Games::Construder::World::light_jobs_pending ());
+
+         for my $id (keys %LIGHT_UNSTAMPED) {
+            my $sec = $LIGHT_UNSTAMPED{$id};
+            next if Games::Construder::World::light_sector_pending (@$sec);
+            delete $LIGHT_UNSTAMPED{$id};
+            world_sector_dirty ($sec);
+         }
+      };
+   }
+
    $STORE_SCHED_TMR = AE::timer 0, 1, sub {
       NEXT:
       my $s = shift @SAVE_SECTORS_QUEUE
@@ -185,7 +247,8 @@ sub world_init {
 
       $SRV->schedule_chunk_upd;
 
-      _calc_some_lights ();
+      my $packed = Games::Construder::World::tick ($PACK_CHUNKS_AFTER);
+      ctr_log (debug => "packed %d cold chunks", $packed) if $packed;
    };
 
    region_init ($region_cmds);
@@ -230,62 +293,188 @@ sub world_free_sector {
    }
    return if $s->{dirty};
    delete $SECTORS{$id};
+   delete $LIGHT_UNSTAMPED{$id};
    my $fchunk = world_secpos2chnkpos ($sec);
-   for my $x (0..4) {
-      for my $y (0..4) {
-         for my $z (0..4) {
-            Games::Construder::World::purge_chunk (
-               $fchunk->[0] + $x,
-               $fchunk->[1] + $y,
-               $fchunk->[2] + $z
-            );
-         }
-      }
+   for my $chnk (_world_sector_chunks ($sec)) {
+      my $cid = world_pos2id ($chnk);
+      delete $SAVED_VERSIONS{$cid};
+      delete $CHUNK_PAYLOAD{$cid};
+      Games::Construder::World::purge_chunk (@$chnk);
    }
 
-   ctr_log (debug => "chunks from @$fchunk +5x5x5 purged");
+   ctr_log (debug => "chunks from @$fchunk +${CHNKS_P_SEC}^3 purged");
 }
 
-my $light_upd_chunks_wait;
+sub _world_active_cell_changed {
+   my ($x, $y, $z, $type, $ent) = @_;
+   ctr_log (debug => "change active cell: %d (%d,%d,%d) (%s)",
+            $type, $x, $y, $z, $ent);
+   my $sec = world_chnkpos2secpos (world_pos2chnkpos ([$x, $y, $z]));
+   my $id  = world_pos2id ($sec);
+   return unless exists $SECTORS{$id};
+   my $eid = world_pos2id ([$x, $y, $z]);
 
-sub _calc_some_lights {
-   my $alloced_time = 0.07;
-   my $t1 = time;
-   my $calced;
+   my $e = delete $SECTORS{$id}->{entities}->{$eid};
+   if ($e) {
+      ctr_log (debug => "entity %s destroy at sector %s entid %s",
+               $e, $id, $eid);
+      Games::Construder::Server::Objects::destroy ($e);
+   }
 
-   {
-      while ((time - $t1) < $alloced_time) {
-         my $pos = shift @LIGHTQUEUE
-            or last;
-         delete $LIGHTQUEUE{world_pos2id ($pos)};
-         my $secid = world_pos2id (world_chnkpos2secpos (world_pos2chnkpos ($pos)));
-         unless (exists $SECTORS{$secid}) {
-            next;
+   unless ($ent) {
+      $ent = Games::Construder::Server::Objects::instance ($type);
+      ctr_log (debug => "instance entity %s at sector %s type %s: %s",
+               $eid, $id, $type, $ent);
+   } else {
+      ctr_log (debug => "put entity %s at sector %s type %s: %s",
+               $eid, $id, $type, $ent);
+   }
+
+   $SECTORS{$id}->{entities}->{$eid} = $ent if $ent;
+}
+
+# Returns the positions of the chunks of the sector, in the order they
+# are stored in the sector files.
+sub _world_sector_chunks {
+   my ($sec) = @_;
+   my $first_chnk = world_secpos2chnkpos ($sec);
+   my @chunks;
+   for my $dx (0..($CHNKS_P_SEC - 1)) {
+      for my $dy (0..($CHNKS_P_SEC - 1)) {
+         for my $dz (0..($CHNKS_P_SEC - 1)) {
+            push @chunks, vaddd ($first_chnk, $dx, $dy, $dz);
          }
+      }
+   }
+   @chunks
+}
 
-         Games::Construder::World::flow_light_query_setup (@$pos, @$pos);
-         Games::Construder::World::flow_light_at (@$pos);
-         my $dirty = Games::Construder::World::query_desetup ();
-         ctr_log (debug => "%d chunks dirty after light calculation at @$pos", $dirty);
-         $calced++;
+# Returns the positions of the 26 sectors around the sector.
+sub _world_sector_neighbours {
+   my ($sec) = @_;
+   my @secs;
+   for my $dx (-1..1) {
+      for my $dy (-1..1) {
+         for my $dz (-1..1) {
+            next unless $dx || $dy || $dz;
+            push @secs, vaddd ($sec, $dx, $dy, $dz);
+         }
       }
    }
-   if ($calced) {
-      ctr_log (profile => "calclight step %0.4f, calced %d lights, %d lights to go\n",
-               time - $t1, $calced, scalar @LIGHTQUEUE);
+   @secs
+}
+
+# Stamps the light of the sector before it is saved: The light of a
+# sector file can be trusted when it's loaded, if it was saved with the
+# current light rules and after its light was computed. The stamp stores
+# the light_serial (bumped with every save) of each loaded neighbour, as
+# its light flows into the sector (and the other way around).
+sub _world_stamp_sector_light {
+   my ($sec) = @_;
+   my $id   = world_pos2id ($sec);
+   my $meta = $SECTORS{$id};
+
+   $meta->{light_serial}++;
+
+   if (Games::Construder::World::light_sector_pending (@$sec)) {
+      delete $meta->{light_stamp};
+      $LIGHT_UNSTAMPED{$id} = [@$sec];
+      return;
+   }
+
+   # the serials of the neighbours that are not loaded stay the same:
+   my $serials = ($meta->{light_stamp} && $meta->{light_stamp}->{neighbours}) || {};
+   for my $n (_world_sector_neighbours ($sec)) {
+      my $nid = world_pos2id ($n);
+      my $nm  = $SECTORS{$nid}
+         or next;
+
+      if ($nm->{broken} || Games::Construder::World::light_sector_pending (@$n)) {
+         delete $serials->{$nid};
+      } else {
+         $serials->{$nid} = $nm->{light_serial} || 0;
+      }
    }
+
+   $meta->{light_stamp} = {
+      version    => $LIGHT_VERSION,
+      neighbours => $serials,
+   };
 }
 
-sub _query_push_lightqueue {
-   my $lightposes = Games::Construder::World::query_search_types (35, 41, 40);
-   while (@$lightposes) {
-      my $pos = [shift @$lightposes, shift @$lightposes, shift @$lightposes];
-      my $id = world_pos2id ($pos);
-      unless ($LIGHTQUEUE{$id}) {
-         $LIGHTQUEUE{$id} = 1;
-         push @LIGHTQUEUE, $pos;
+# Computes the light at the borders of the freshly loaded sector to those
+# loaded neighbours, that changed while it was not loaded (or the other
+# way around). See _world_stamp_sector_light. The rest of the light of
+# the sector is taken from the sector file as is.
+sub _world_relight_sector_borders {
+   my ($sec) = @_;
+   my $id      = world_pos2id ($sec);
+   my $meta    = $SECTORS{$id};
+   my $serials = $meta->{light_stamp}->{neighbours} || {};
+
+   my $cnt = 0;
+   for my $n (_world_sector_neighbours ($sec)) {
+      my $nid = world_pos2id ($n);
+      my $nm  = $SECTORS{$nid}
+         or next; # checks this sector when it is loaded
+      next if $nm->{broken};
+
+      my $nserials = ($nm->{light_stamp} && $nm->{light_stamp}->{neighbours}) || {};
+      next if !$nm->{dirty}
+              && defined $serials->{$nid}
+              && $serials->{$nid} == ($nm->{light_serial} || 0)
+              && defined $nserials->{$id}
+              && $nserials->{$id} == ($meta->{light_serial} || 0);
+
+      # every cell of both sectors that light might have reached across
+      # the border:
+      my ($min, $max) = ([], []);
+      for (0..2) {
+         my ($a, $b) = ($sec->[$_] * $SEC_SIZE, $n->[$_] * $SEC_SIZE);
+         $min->[$_] = ($a > $b ? $a : $b) - $LIGHT_REACH;
+         $max->[$_] = ($a < $b ? $a : $b) + $SEC_SIZE - 1 + $LIGHT_REACH;
       }
+
+      Games::Construder::World::flow_light_query_setup (@$min, @$max, $SECTOR_QUERY);
+      Games::Construder::World::flow_light_box (@$min, @$max, $SECTOR_QUERY);
+      Games::Construder::World::query_desetup (0, $SECTOR_QUERY);
+      $cnt++;
+   }
+
+   ctr_log (debug => "relit %d borders of sector %s", $cnt, $id) if $cnt;
+}
+
+# Remembers the current versions of the chunks of the sector as the
+# ones that are stored in the sector file.
+sub _world_sector_saved {
+   my ($sec) = @_;
+   my @chunks = _world_sector_chunks ($sec);
+   my $versions =
+      Games::Construder::World::get_chunk_versions ([map { @$_ } @chunks]);
+   for (@chunks) {
+      $SAVED_VERSIONS{world_pos2id ($_)} = shift @$versions;
+   }
+}
+
+# the chunks are serialized into the same buffer every time:
+my $chunk_buf;
+
+# Returns the version and the compressed data of the chunk, like it is
+# sent to the clients. The compressed data is cached until the chunk
+# changes. Returns the empty list if the chunk is not allocated.
+sub world_chunk_payload {
+   my ($chnk) = @_;
+   my ($version) = @{Games::Construder::World::get_chunk_versions ($chnk)};
+   return unless defined $version;
+
+   my $id = world_pos2id ($chnk);
+   my $p  = $CHUNK_PAYLOAD{$id};
+   unless ($p && $p->[0] == $version) {
+      Games::Construder::World::get_chunk_data_into (@$chnk, $chunk_buf);
+      $p = $CHUNK_PAYLOAD{$id} = [$version, compress ($chunk_buf)];
    }
+
+   @$p
 }
 
 sub _world_make_sector {
@@ -311,11 +500,11 @@ sub _world_make_sector {
      { size => $cube, seed => $seed, param => $param }
    );
 
-   Games::Construder::VolDraw::dst_to_world (@$sec, $stype->{ranges} || []);
+   Games::Construder::VolDraw::dst_to_world (@$sec, $stype->{ranges} || [], $SECTOR_QUERY);
 
-   my $pospos = Games::Construder::World::query_possible_light_positions ();
+   my $pospos = Games::Construder::World::query_possible_light_positions ($SECTOR_QUERY);
 
-   Games::Construder::World::query_desetup (1);
+   Games::Construder::World::query_desetup (1, $SECTOR_QUERY);
 
    my $lower_left  = vsmul ($sec, $CHNK_SIZE * $CHNKS_P_SEC);
    my $upper_right =
@@ -324,7 +513,7 @@ sub _world_make_sector {
              $CHNKS_P_SEC * $CHNK_SIZE,
              $CHNKS_P_SEC * $CHNK_SIZE);
 
-   Games::Construder::World::flow_light_query_setup (@$lower_left, @$upper_right);
+   Games::Construder::World::flow_light_query_setup (@$lower_left, @$upper_right, $SECTOR_QUERY);
 
    my $t1 = time;
 
@@ -359,11 +548,13 @@ sub _world_make_sector {
       last unless $p;
 
       Games::Construder::World::query_set_at_abs (
-         @$p, [$type, 0, 0, 0, 0]);
+         @$p, [$type, 0, 0, 0, 0], $SECTOR_QUERY);
       $plcnt++;
    }
 
-   _query_push_lightqueue ();
+   # all lights of the sector at once, the chunk updates and saving the
+   # light follow when the job is done:
+   Games::Construder::World::light_sector_job (@$sec);
    $tsum += time - $t1;
 
    my $smeta = $SECTORS{world_pos2id ($sec)} = {
@@ -382,7 +573,7 @@ sub _world_make_sector {
    ctr_log (profile => "created sector @$sec in $smeta->{creation_time} seconds");
 
    {
-      Games::Construder::World::query_desetup (2);
+      Games::Construder::World::query_desetup (2, $SECTOR_QUERY);
    }
 
    ctr_log (debug => "placed $cnt / $plcnt lights $type ($flot) in $tsum!\n");
@@ -437,25 +628,29 @@ sub _world_load_sector {
          return -1;
       }
 
+      my $chunk_size = $meta->{chunk_size} || 12; # older sectors don't store it
+      if ($chunk_size != $CHNK_SIZE) {
+         ctr_log (error =>
+              "map sector file '$file' was created with chunk size $chunk_size, "
+              . "but the server was built with chunk size $CHNK_SIZE!");
+         return -1;
+      }
+
       $SECTORS{$id} = $meta;
       $meta->{load_time} = time;
 
+      my $stamp = $meta->{light_stamp};
+      my $light_ok = $stamp && ($stamp->{version} || 0) == $LIGHT_VERSION;
+
       {
-         my $offs;
-         my $first_chnk = world_secpos2chnkpos ($sec);
-         my @chunks;
-         for my $dx (0..($CHNKS_P_SEC - 1)) {
-            for my $dy (0..($CHNKS_P_SEC - 1)) {
-               for my $dz (0..($CHNKS_P_SEC - 1)) {
-                  my $chnk = vaddd ($first_chnk, $dx, $dy, $dz);
-
-                  my $len = shift @lens;
-                  my $chunk = substr $data, $offs, $len;
-                  Games::Construder::World::set_chunk_data (
-                     @$chnk, $chunk, length ($chunk));
-                  $offs += $len;
-               }
-            }
+         # all chunks at once, the chunk updates are sent below:
+         eval {
+            Games::Construder::World::set_sector_data (@$sec, $data, \@lens);
+         };
+         if ($@) {
+            ctr_log (error => "map sector file '$file' corrupted: $@");
+            delete $SECTORS{$id};
+            return -1;
          }
 
          my $lower_left  = vsmul ($sec, $CHNK_SIZE * $CHNKS_P_SEC);
@@ -465,15 +660,23 @@ sub _world_load_sector {
                    $CHNKS_P_SEC * $CHNK_SIZE,
                    $CHNKS_P_SEC * $CHNK_SIZE);
 
-         Games::Construder::World::flow_light_query_setup (@$lower_left, @$upper_right);
-         _query_push_lightqueue ();
-         Games::Construder::World::query_desetup (2);
+         Games::Construder::World::flow_light_query_setup (@$lower_left, @$upper_right, $SECTOR_QUERY);
+         Games::Construder::World::query_desetup (2, $SECTOR_QUERY);
       }
 
+      delete $SECTORS{$id}->{dirty}; # saved with the sector
+      _world_sector_saved ($sec);
 
-      my ($ecnt) = scalar (keys %{$SECTORS{$id}->{entities}});
+      # the light was saved with the sector, only its borders might need
+      # an update. Otherwise the changed light follows when the light job
+      # is done:
+      if ($light_ok) {
+         _world_relight_sector_borders ($sec);
+      } else {
+         Games::Construder::World::light_sector_job (@$sec);
+      }
 
-      delete $SECTORS{$id}->{dirty}; # saved with the sector
+      my ($ecnt) = scalar (keys %{$SECTORS{$id}->{entities}});
       ctr_log (info => "loaded sector %s from '%s', got %d entities, loading took %0.3f seconds",
                $id, $file, $ecnt, time - $t1);
       return 1;
@@ -497,19 +700,11 @@ sub _world_save_sector {
       return;
    }
 
-   $meta->{save_time} = time;
+   $meta->{save_time}  = time;
+   $meta->{chunk_size} = $CHNK_SIZE;
+   _world_stamp_sector_light ($sec);
 
-   my $first_chnk = world_secpos2chnkpos ($sec);
-   my @chunks;
-   for my $dx (0..($CHNKS_P_SEC - 1)) {
-      for my $dy (0..($CHNKS_P_SEC - 1)) {
-         for my $dz (0..($CHNKS_P_SEC - 1)) {
-            my $chnk = vaddd ($first_chnk, $dx, $dy, $dz);
-            push @chunks,
-               Games::Construder::World::get_chunk_data (@$chnk);
-         }
-      }
-   }
+   my ($data, @lens) = @{Games::Construder::World::get_sector_data (@$sec)};
 
    my ($ecnt) = scalar (keys %{$SECTORS{$id}->{entities}});
 
@@ -519,10 +714,9 @@ sub _world_save_sector {
    }
    my $meta_data = JSON->new->utf8->pretty->encode ($meta || {});
 
-   my $data = join "", @chunks;
    my $filedata = compress (
       $meta_data . "\n\nMAPDATA "
-      . join (' ', map { length $_ } ($data, @chunks))
+      . join (' ', length ($data), @lens)
       . "\n\n" . $data
    );
 
@@ -540,6 +734,7 @@ sub _world_save_sector {
 
       if (rename "$file~", $file) {
          delete $SECTORS{$id}->{dirty};
+         _world_sector_saved ($sec);
          ctr_log (info =>
               "saved sector $id to '$file', saved $ecnt entities, took %.3f seconds, wrote %d bytes",
               time - $t1, length($filedata));
@@ -761,12 +956,12 @@ sub world_mutate_at {
          }
       }
      #d# warn "MUTL @$min | @$max\n";
-      Games::Construder::World::flow_light_query_setup (@$min, @$max);
+      Games::Construder::World::flow_light_query_setup (@$min, @$max, $MUTATE_QUERY);
 
    } else {
       world_load_at ($poses); # blocks for now :-/
 
-      Games::Construder::World::flow_light_query_setup (@$poses, @$poses);
+      Games::Construder::World::flow_light_query_setup (@$poses, @$poses, $MUTATE_QUERY);
       $poses = [$poses];
    }
 
@@ -778,17 +973,17 @@ sub world_mutate_at {
       #d# print "MULT MUTATING (@$b) (AT @$pos)\n";
       if ($cb->($b, $pos)) {
          #d# print "MULT MUTATING TO => (@$b) (AT @$pos)\n";
-         Games::Construder::World::query_set_at_abs (@$pos, $b);
+         Games::Construder::World::query_set_at_abs (@$pos, $b, $MUTATE_QUERY);
          unless ($arg{no_light}) {
             my $t1 = time;
-            Games::Construder::World::flow_light_at (@{vfloor ($pos)});
+            Games::Construder::World::flow_light_at (@{vfloor ($pos)}, $MUTATE_QUERY);
             ctr_log (profile => "mult light calc at pos @$pos took: %f secs\n", time - $t1);
          }
       }
    }
 
    {
-     my $dirty = Games::Construder::World::query_desetup ();
+     my $dirty = Games::Construder::World::query_desetup (0, $MUTATE_QUERY);
      ctr_log (debug => "%d chunks dirty after mutation and possible light flow", $dirty);
    }
 
@@ -19,171 +19,405 @@
  * by propagating the light from a light source or other bright block
  * to it's neighbors.
  *
- * It's more or less a simple cellular automaton. The light level of a
- * block is computed from the maximum of the surrounding cells.
+ * A transparent block gets the maximum light of its neighbours minus
+ * one, a light source block has the light it emits and every other
+ * block is dark.
  *
- * But the algorithm does not recompute the whole volume this way, but
- * tries to find out the affected area using a flood fill before starting
- * the fix point iteration of computing the light of the cells within that area.
+ * A change is propagated with two queues, like a breadth first search:
+ * The removal queue darkens the cells that were lit by the light that
+ * went away, and collects the brighter cells at the border of that area
+ * in the addition queue. The addition queue then spreads the light of
+ * its cells (and of new light sources) to the darker neighbours. Every
+ * cell is only visited a few times and no fix point iteration is needed.
  */
 
-// Utility function to get the maximum light level from the neighbors.
-unsigned char ctr_world_query_get_max_light_of_neighbours (x, y, z)
+// The light emitted by a cell of the given (non transparent) type.
+static unsigned char ctr_world_light_emission (unsigned int type)
 {
-  ctr_cell *above = ctr_world_query_cell_at (x, y + 1, z, 0);
-  ctr_cell *below = ctr_world_query_cell_at (x, y - 1, z, 0);
-  ctr_cell *left  = ctr_world_query_cell_at (x - 1, y, z, 0);
-  ctr_cell *right = ctr_world_query_cell_at (x + 1, y, z, 0);
-  ctr_cell *front = ctr_world_query_cell_at (x, y, z - 1, 0);
-  ctr_cell *back  = ctr_world_query_cell_at (x, y, z + 1, 0);
-  unsigned char l = 0;
-  if (above && above->light > l) l = above->light;
-  if (below && below->light > l) l = below->light;
-  if (left  && left->light  > l) l = left->light;
-  if (right && right->light > l) l = right->light;
-  if (front && front->light > l) l = front->light;
-  if (back  && back->light  > l) l = back->light;
-  return l;
+  switch (type)
+    {
+      case 41: return 8;
+      case 35: return 12;
+      case 40: return 15;
+      default: return 0;
+    }
+}
+
+static const int ctr_light_neighbour_offs[6][3] = {
+  { -1, 0, 0 }, { 1, 0, 0 },
+  { 0, -1, 0 }, { 0, 1, 0 },
+  { 0, 0, -1 }, { 0, 0, 1 },
+};
+
+/* Returns the chunk and (in noffs) the offset of the neighbour in direction
+ * i (see ctr_light_neighbour_offs) of the cell at x,y,z, which is at offs in
+ * chnk. Only neighbours in other chunks need a lookup.
+ */
+static ctr_chunk *ctr_world_light_neighbour (ctr_chunk *chnk, unsigned int offs, int x, int y, int z, int i, unsigned int *noffs)
+{
+  static const int stride[3] = { 1, CHUNK_SIZE, CHUNK_SIZE * CHUNK_SIZE };
+  int axis = i >> 1,
+      r = (axis == 0 ? x : axis == 1 ? y : z) % CHUNK_SIZE;
+
+  if (i & 1 ? r < CHUNK_SIZE - 1 : r > 0)
+    {
+      *noffs = i & 1 ? offs + stride[axis] : offs - stride[axis];
+      return chnk;
+    }
+
+  return ctr_world_query_cell_at (
+           x + ctr_light_neighbour_offs[i][0],
+           y + ctr_light_neighbour_offs[i][1],
+           z + ctr_light_neighbour_offs[i][2], 0, noffs);
+}
+
+/* The cells on the border of the query context keep their light, so the
+ * light from the outside flows in from there. w holds the size of the
+ * context along each axis, see LIGHT_QUERY_W.
+ */
+#define LIGHT_IN_MARGIN(x,y,z,w) \
+  ((x) <= 0 || (y) <= 0 || (z) <= 0 \
+   || (x) >= (w)[0] - 1 || (y) >= (w)[1] - 1 || (z) >= (w)[2] - 1)
+
+#define LIGHT_QUERY_W(w) \
+  int w[3] = { \
+    QUERY_CONTEXT.x_w * CHUNK_SIZE, \
+    QUERY_CONTEXT.y_w * CHUNK_SIZE, \
+    QUERY_CONTEXT.z_w * CHUNK_SIZE \
+  }
+
+/* A bit per cell of the query context, for the light computations that
+ * must visit a cell only once. The light values themselves are never
+ * used to mark cells.
+ */
+static unsigned char *ctr_light_visited     = 0;
+static unsigned int   ctr_light_visited_len = 0;
+
+// Clears the visited cells, for a new light computation.
+static void ctr_world_light_visited_clear ()
+{
+  unsigned int len =
+    (QUERY_CONTEXT.x_w * QUERY_CONTEXT.y_w * QUERY_CONTEXT.z_w * CHUNK_ALEN + 7) / 8;
+
+  if (len > ctr_light_visited_len)
+    {
+      if (ctr_light_visited)
+        safefree (ctr_light_visited);
+      ctr_light_visited     = safemalloc (len);
+      ctr_light_visited_len = len;
+    }
+
+  memset (ctr_light_visited, 0, len);
+}
+
+/* Marks the cell at x,y,z (context relative, within the context) as
+ * visited. Returns 1 if it was already visited.
+ */
+static int ctr_world_light_visit (int x, int y, int z)
+{
+  unsigned int w = QUERY_CONTEXT.x_w * CHUNK_SIZE,
+               h = QUERY_CONTEXT.y_w * CHUNK_SIZE,
+               i = x + (y + z * h) * w;
+  unsigned char bit = 1 << (i & 7);
+
+  if (ctr_light_visited[i >> 3] & bit)
+    return 1;
+
+  ctr_light_visited[i >> 3] |= bit;
+  return 0;
 }
 
 // (Re)flows the light within a query context at the position x,y,z.
 void ctr_world_query_reflow_light (int x, int y, int z)
 {
-  int query_w = QUERY_CONTEXT.x_w * CHUNK_SIZE;
+  LIGHT_QUERY_W (query_w);
 
   ctr_world_light_upd_start ();
 
-  ctr_cell *cur = ctr_world_query_cell_at (x, y, z, 0);
+  unsigned int offs;
+  ctr_chunk *cur = ctr_world_query_cell_at (x, y, z, 0, &offs);
   if (!cur)
     return;
 
-  /* First part of this function tries to find out what kind of
-   * light change should be recomputed.
-   */
+  int transparent = ctr_world_cell_transparent (cur, offs);
+  if (transparent && LIGHT_IN_MARGIN (x, y, z, query_w))
+    return;
 
-  unsigned char l = ctr_world_query_get_max_light_of_neighbours (x, y, z);
+  /* The changed cell gets the light it emits, a transparent one starts
+   * dark and is lit by its neighbours again below.
+   */
+  cur = ctr_world_query_cell_at (x, y, z, 1, &offs);
+  unsigned char old_light = CELL_LIGHT (cur, offs),
+                new_light =
+                  transparent ? 0 : ctr_world_light_emission (CELL_TYPE (cur, offs));
+  CELL_LIGHT (cur, offs) = new_light;
 
-  if (ctr_world_cell_transparent (cur)) // a transparent cell has changed
+  /* The caller might already have overwritten the old light of the cell
+   * (new lights are usually set with light 0), so assume it was as bright
+   * as any of its neighbours could have gotten through it.
+   */
+  int i, nx, ny, nz;
+  unsigned int offs_n;
+  ctr_chunk *n;
+  for (i = 0; i < 6; i++)
     {
-      if (l > 0) l--;
-#if DEBUG_LIGHT
-      printf ("transparent cell at %d,%d,%d has light %d, neighbors say: %d\n", x, y, z, (int) cur->light, (int) l);
-#endif
-      if (cur->light < l)
-        {
-          ctr_world_light_enqueue (x, y, z, l);
-        }
-      else if (cur->light > l) // we are brighter then the neighbors
-        {
-          ctr_world_light_enqueue (x, y, z, cur->light);
-        }
-      else // cur->light == l
-        {
-          // we are transparent and have the light we should have
-          // so we don't need to change anything.
-          // XXX: BUT: still force update :)
-          ctr_world_query_cell_at (x, y, z, 1);
-          return; // => no change, so no change for anyone else
-        }
+      n = ctr_world_query_cell_at (
+            x + ctr_light_neighbour_offs[i][0],
+            y + ctr_light_neighbour_offs[i][1],
+            z + ctr_light_neighbour_offs[i][2], 0, &offs_n);
+      if (n && CELL_LIGHT (n, offs_n) >= old_light)
+        old_light = CELL_LIGHT (n, offs_n) + 1;
     }
-  else // oh, a (light) blocking cell has been set!
+
+  if (old_light > new_light)
     {
-      ctr_cell *cur = ctr_world_query_cell_at (x, y, z, 1);
-      if (!cur)
-        return;
-
-      if (cur->type == 41) // was a light: light it!
-        cur->light = 8;
-      else if (cur->type == 35) // was a light: light it!
-        cur->light = 12;
-      else if (cur->type == 40) // was a light: light it!
-        cur->light = 15;
-      else // oh boy, we will become darker, we are a intransparent block!
-        cur->light = 0; // we are blocking light, so we are dark
-
-      // if we are brighter than our neighbours, set our
-      // light value are update radius
-      if (cur->light > l)
-        l = cur->light;
-      ctr_world_light_enqueue_neighbours (x, y, z, l);
+      ctr_world_light_visited_clear ();
+      ctr_world_light_select_queue (0);
+      ctr_world_light_enqueue (x, y, z, old_light);
     }
 
-  /* The following loop tries to find the affected area by flood filling it.
-   * While doing that it will compute the queue used in the next loops.
+  ctr_world_light_select_queue (1);
+  if (new_light > 0)
+    ctr_world_light_enqueue (x, y, z, new_light);
+  if (transparent)
+    ctr_world_light_enqueue_neighbours (x, y, z, 0);
+
+  /* Darken everything that got its light from the removed light. A
+   * neighbour that is at least as bright as the removed light (or can't
+   * be changed) got it from somewhere else and spreads it again, it's
+   * queued only once even if it borders many darkened cells.
    */
-  unsigned char upd_radius = 0;
-  while (ctr_world_light_dequeue (&x, &y, &z, &upd_radius))
+  unsigned char lv;
+  ctr_world_light_select_queue (0);
+  while (ctr_world_light_dequeue (&x, &y, &z, &lv))
+    for (i = 0; i < 6; i++)
+      {
+        nx = x + ctr_light_neighbour_offs[i][0];
+        ny = y + ctr_light_neighbour_offs[i][1];
+        nz = z + ctr_light_neighbour_offs[i][2];
+        cur = ctr_world_query_cell_at (nx, ny, nz, 0, &offs);
+        if (!cur || !CELL_LIGHT (cur, offs))
+          continue;
+
+        unsigned char nl = CELL_LIGHT (cur, offs);
+        if (nl < lv
+            && ctr_world_cell_transparent (cur, offs)
+            && !LIGHT_IN_MARGIN (nx, ny, nz, query_w))
+          {
+            cur = ctr_world_query_cell_at (nx, ny, nz, 1, &offs);
+            CELL_LIGHT (cur, offs) = 0;
+            ctr_world_light_enqueue (nx, ny, nz, nl);
+          }
+        else if (!ctr_world_light_visit (nx, ny, nz))
+          {
+            ctr_world_light_select_queue (1);
+            ctr_world_light_enqueue (nx, ny, nz, nl);
+            ctr_world_light_select_queue (0);
+          }
+      }
+
+  // spread the light to the darker transparent neighbours:
+  ctr_world_light_select_queue (1);
+  while (ctr_world_light_dequeue (&x, &y, &z, &lv))
     {
-      // leave a margin, so we can reflow light from the outside...
-      if (x <= 0 || y <= 0 || z <= 0
-          || x >= (query_w - 1)
-          || y >= (query_w - 1)
-          || z >= (query_w - 1))
+      cur = ctr_world_query_cell_at (x, y, z, 0, &offs);
+      if (!cur || CELL_LIGHT (cur, offs) <= 1)
         continue;
 
-      cur = ctr_world_query_cell_at (x, y, z, 0);
-      if (!cur || !ctr_world_cell_transparent (cur) || cur->light == 255)
-        continue; // ignore blocks that can't be lit or were already visited
-
-      cur = ctr_world_query_cell_at (x, y, z, 1);
-      assert (cur);
+      lv = CELL_LIGHT (cur, offs) - 1;
+      for (i = 0; i < 6; i++)
+        {
+          nx = x + ctr_light_neighbour_offs[i][0];
+          ny = y + ctr_light_neighbour_offs[i][1];
+          nz = z + ctr_light_neighbour_offs[i][2];
+          cur = ctr_world_query_cell_at (nx, ny, nz, 0, &offs);
+          if (!cur
+              || CELL_LIGHT (cur, offs) >= lv
+              || !ctr_world_cell_transparent (cur, offs)
+              || LIGHT_IN_MARGIN (nx, ny, nz, query_w))
+            continue;
 
-      cur->light = 255; // insert "visited" marker
-      ctr_world_light_select_queue (1);
-      ctr_world_light_enqueue (x, y, z, 1);
-      ctr_world_light_select_queue (0);
-      if (upd_radius > 0)
-        ctr_world_light_enqueue_neighbours (x, y, z, upd_radius - 1);
+          cur = ctr_world_query_cell_at (nx, ny, nz, 1, &offs);
+          CELL_LIGHT (cur, offs) = lv;
+          ctr_world_light_enqueue (nx, ny, nz, lv);
+        }
     }
+}
+
+/* Computes the light of all cells in the box x,y,z - ex,ey,ez (context
+ * relative, inclusive) from scratch, eg. after a sector was generated or
+ * loaded: The box is darkened and the light of its light sources and of
+ * the lit cells around it is spread in one breadth first sweep, level by
+ * level and brightest first, so that every cell is set only once. The
+ * light also spreads out of the box, but only brightens the cells there.
+ */
+void ctr_world_query_relight_box (int x, int y, int z, int ex, int ey, int ez)
+{
+  LIGHT_QUERY_W (query_w);
 
-  /* Next loop clears all 255-values that were used to mark the
-   * already visited cells.
+  // the margin keeps its light, see LIGHT_IN_MARGIN:
+  if (x < 1) x = 1;
+  if (y < 1) y = 1;
+  if (z < 1) z = 1;
+  if (ex > query_w[0] - 2) ex = query_w[0] - 2;
+  if (ey > query_w[1] - 2) ey = query_w[1] - 2;
+  if (ez > query_w[2] - 2) ez = query_w[2] - 2;
+  if (x > ex || y > ey || z > ez)
+    return;
+
+  ctr_world_light_upd_start ();
+
+  /* Only the light of the chunks of the box changes, and many of their
+   * cells usually get the light they had before. So they are written
+   * directly and compared with their old light at the end, which records
+   * only the cells that really changed.
    */
-  ctr_world_light_select_queue (1);
-  ctr_world_light_freeze_queue ();
+  int cx0 = x / CHUNK_SIZE, cx1 = ex / CHUNK_SIZE,
+      cy0 = y / CHUNK_SIZE, cy1 = ey / CHUNK_SIZE,
+      cz0 = z / CHUNK_SIZE, cz1 = ez / CHUNK_SIZE,
+      cx, cy, cz, k = 0;
+  unsigned char *old_light =
+    safemalloc ((cx1 - cx0 + 1) * (cy1 - cy0 + 1) * (cz1 - cz0 + 1) * CHUNK_ALEN);
+  for (cz = cz0; cz <= cz1; cz++)
+    for (cy = cy0; cy <= cy1; cy++)
+      for (cx = cx0; cx <= cx1; cx++, k++)
+        {
+          ctr_chunk *chnk = QUERY_CHUNK(cx, cy, cz);
+          if (!chnk)
+            continue;
+          if (chnk->packed)
+            ctr_chunk_unpack (chnk);
+          ctr_chunk_unshare (chnk);
+          memcpy (&(old_light[k * CHUNK_ALEN]), chnk->cells->light, CHUNK_ALEN);
+        }
 
-  while (ctr_world_light_dequeue (&x, &y, &z, &upd_radius))
+  /* Queue 0 holds the sources: the light sources in the box, which
+   * get the light they emit, and the lit cells right next to the box.
+   */
+  unsigned int sources = 0, j;
+  ctr_world_query_cursor c;
+  ctr_world_light_select_queue (0);
+
+  ctr_world_query_cursor_init (&c, x, y, z, ex, ey, ez, 0);
+  while (ctr_world_query_cursor_next (&c))
     {
-      cur = ctr_world_query_cell_at (x, y, z, 1);
-      if (!cur)
-        continue;
-      cur->light = 0;
+      unsigned short *type  = &(c.chnk->cells->type[c.offs]);
+      unsigned char  *light = &(c.chnk->cells->light[c.offs]);
+      for (j = 0; j < c.len; j++)
+        {
+          light[j] =
+            OBJ_TRANSPARENT[type[j]] ? 0 : ctr_world_light_emission (type[j]);
+          if (light[j] > 1)
+            {
+              ctr_world_light_enqueue (c.x + j, c.y, c.z, light[j]);
+              sources++;
+            }
+        }
     }
 
-  /* Now we iterate over the working set in the queue and
-   * compute the light from the neighbors.
+  int i;
+  for (i = 0; i < 6; i++)
+    {
+      int d = i & 1 ? 1 : -1,
+          bx = x, by = y, bz = z, ebx = ex, eby = ey, ebz = ez;
+      if (ctr_light_neighbour_offs[i][0])
+        bx = ebx = d > 0 ? ex + 1 : x - 1;
+      else if (ctr_light_neighbour_offs[i][1])
+        by = eby = d > 0 ? ey + 1 : y - 1;
+      else
+        bz = ebz = d > 0 ? ez + 1 : z - 1;
+
+      ctr_world_query_cursor_init (&c, bx, by, bz, ebx, eby, ebz, 0);
+      while (ctr_world_query_cursor_next (&c))
+        {
+          unsigned char *light = &(c.chnk->cells->light[c.offs]);
+          for (j = 0; j < c.len; j++)
+            if (light[j] > 1)
+              {
+                ctr_world_light_enqueue (c.x + j, c.y, c.z, light[j]);
+                sources++;
+              }
+        }
+    }
+
+  /* Queue 1 holds the cells of the current light level, followed by the
+   * ones they lit, which are one level darker. The sources of a level are
+   * added before that level is spread.
    */
-  int change = 1;
-  int pass = 0;
-  while (change)
+  unsigned int level_cnt = 0, next_cnt, n;
+  unsigned char l, lv;
+  unsigned int offs, noffs;
+  ctr_chunk *cur;
+  int px, py, pz, nx, ny, nz;
+  for (l = 15; l > 1; l--)
     {
-      change = 0;
-      pass++;
-#if DEBUG_LIGHT
-      printf ("START RELIGHT PASS %d\n", pass);
-#endif
-      ctr_world_light_thaw_queue ();
-      // recompute light for every cell in the queue
-      while (ctr_world_light_dequeue (&x, &y, &z, &upd_radius))
+      n = sources;
+      while (n-- > 0)
+        {
+          ctr_world_light_select_queue (0);
+          ctr_world_light_dequeue (&px, &py, &pz, &lv);
+          if (lv != l)
+            {
+              ctr_world_light_enqueue (px, py, pz, lv);
+              continue;
+            }
+
+          ctr_world_light_select_queue (1);
+          ctr_world_light_enqueue (px, py, pz, lv);
+          level_cnt++;
+          sources--;
+        }
+
+      ctr_world_light_select_queue (1);
+      next_cnt = 0;
+      while (level_cnt > 0)
         {
-          cur = ctr_world_query_cell_at (x, y, z, 0);
-          if (!cur)
+          level_cnt--;
+          ctr_world_light_dequeue (&px, &py, &pz, &lv);
+
+          // a source might have been lit brighter from somewhere else:
+          cur = ctr_world_query_cell_at (px, py, pz, 0, &offs);
+          if (!cur || CELL_LIGHT (cur, offs) != l)
             continue;
 
-          unsigned char l = ctr_world_query_get_max_light_of_neighbours (x, y, z);
-          if (l > 0) l--;
-#if DEBUG_LIGHT
-          printf ("[%d] relight at %d,%d,%d, me: %d, cur neigh: %d\n", pass, x, y, z, cur->light, l);
-#endif
-          // if the current cell is too dark, relight it
-          if (cur->light < l)
+          for (i = 0; i < 6; i++)
             {
-              cur = ctr_world_query_cell_at (x, y, z, 1);
-              assert (cur);
+              ctr_chunk *n = ctr_world_light_neighbour (cur, offs, px, py, pz, i, &noffs);
+              if (!n
+                  || CELL_LIGHT (n, noffs) >= l - 1
+                  || !ctr_world_cell_transparent (n, noffs))
+                continue;
+
+              nx = px + ctr_light_neighbour_offs[i][0];
+              ny = py + ctr_light_neighbour_offs[i][1];
+              nz = pz + ctr_light_neighbour_offs[i][2];
+              if (LIGHT_IN_MARGIN (nx, ny, nz, query_w))
+                continue;
 
-              cur->light = l;
-              change = 1;
+              // the chunks of the box are recorded below:
+              if (nx < cx0 * CHUNK_SIZE || nx >= (cx1 + 1) * CHUNK_SIZE
+                  || ny < cy0 * CHUNK_SIZE || ny >= (cy1 + 1) * CHUNK_SIZE
+                  || nz < cz0 * CHUNK_SIZE || nz >= (cz1 + 1) * CHUNK_SIZE)
+                n = ctr_world_query_cell_at (nx, ny, nz, 1, &noffs);
+              CELL_LIGHT (n, noffs) = l - 1;
+              if (l - 1 > 1)
+                {
+                  ctr_world_light_enqueue (nx, ny, nz, l - 1);
+                  next_cnt++;
+                }
             }
         }
+      level_cnt = next_cnt;
     }
+
+  k = 0;
+  for (cz = cz0; cz <= cz1; cz++)
+    for (cy = cy0; cy <= cy1; cy++)
+      for (cx = cx0; cx <= cx1; cx++, k++)
+        {
+          ctr_chunk *chnk = QUERY_CHUNK(cx, cy, cz);
+          if (chnk)
+            ctr_chunk_light_changed (chnk, &(old_light[k * CHUNK_ALEN]));
+        }
+  safefree (old_light);
 }
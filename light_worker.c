@@ -0,0 +1,639 @@
+/*
+ * Games::Construder - A 3D Game written in Perl with an infinite and modifiable world.
+ * Copyright (C) 2011  Robin Redeker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file holds the light jobs, which light a whole sector (like
+ * ctr_world_query_relight_box ()) on a pool of worker threads.
+ *
+ * A job copies the cells of the chunks of the sector and of the chunks
+ * around it, as far as its light can reach. A worker lays them out in a
+ * grid and computes the new light without touching the world. The main
+ * thread then copies the light of the changed chunks back
+ * (ctr_world_light_jobs_commit ()) and reports them like a query does.
+ * If any of the chunks was changed in the meantime the job is copied and
+ * computed again. Jobs of neighbouring sectors, whose chunks overlap, are
+ * not run at the same time, so they don't have to.
+ *
+ * The workers signal finished jobs by writing a byte into a pipe, the
+ * read end is for the event loop (see ctr_world_light_workers ()).
+ */
+#ifndef _WIN32
+# define CTR_LIGHT_THREADS 1
+# include <pthread.h>
+# include <unistd.h>
+# include <fcntl.h>
+#endif
+
+/* The light of the sector reaches at most 14 cells out of it, the cells
+ * further out only pass their light in and are never changed.
+ */
+#define CTR_LIGHT_JOB_PAD  15
+#define CTR_LIGHT_JOB_BOX  (CHUNKS_P_SECTOR * CHUNK_SIZE)
+#define CTR_LIGHT_JOB_W    (CTR_LIGHT_JOB_BOX + 2 * CTR_LIGHT_JOB_PAD)
+#define CTR_LIGHT_JOB_LEN  (CTR_LIGHT_JOB_W * CTR_LIGHT_JOB_W * CTR_LIGHT_JOB_W)
+
+#define CTR_LIGHT_JOB_IDX(x,y,z) \
+  ((x) + (y) * CTR_LIGHT_JOB_W + (z) * CTR_LIGHT_JOB_W * CTR_LIGHT_JOB_W)
+
+// The attributes of a grid cell: the light it emits and this flag.
+#define CTR_LIGHT_JOB_TRANSPARENT 0x10
+
+typedef struct _ctr_light_job {
+    int sx, sy, sz;
+
+    // the first cell of the grid and its chunk (absolute coordinates):
+    int x, y, z;
+    int cx, cy, cz;
+    int chunks_w;
+
+    /* Per chunk (in the order of the query context): version + 1 when it
+     * was copied (0 if it's missing), the copy of its types and light and
+     * whether the worker changed the light.
+     */
+    unsigned long long *versions;
+    unsigned short     *type;
+    unsigned char      *light;
+    unsigned char      *changed;
+
+    // the attributes of the object types when the job was copied:
+    unsigned char attr[POSSIBLE_OBJECTS];
+
+    // in the queues of the workers:
+    struct _ctr_light_job *next;
+
+    // in the list of jobs that are not committed yet (main thread only):
+    struct _ctr_light_job *pending_next;
+    int running;
+} ctr_light_job;
+
+static ctr_world_query ctr_light_job_query;
+
+// Sets up ctr_light_job_query for the chunks of the job.
+static void ctr_light_job_query_setup (ctr_light_job *job)
+{
+  ctr_world_query_setup (
+    job->cx, job->cy, job->cz,
+    job->cx + job->chunks_w - 1,
+    job->cy + job->chunks_w - 1,
+    job->cz + job->chunks_w - 1);
+  ctr_world_query_load_chunks (0);
+}
+
+static unsigned int ctr_light_job_chunks (ctr_light_job *job)
+{
+  return job->chunks_w * job->chunks_w * job->chunks_w;
+}
+
+// Copies the chunks from the world, on the main thread.
+static void ctr_light_job_copy (ctr_light_job *job)
+{
+  QUERY_USE_FIXED (&ctr_light_job_query);
+  ctr_light_job_query_setup (job);
+
+  unsigned int i, chunks = ctr_light_job_chunks (job);
+  if (!job->type)
+    {
+      job->type  = safemalloc (sizeof (unsigned short) * CHUNK_ALEN * chunks);
+      job->light = safemalloc (CHUNK_ALEN * chunks);
+    }
+  memset (job->changed, 0, chunks);
+
+  for (i = 0; i < POSSIBLE_OBJECTS; i++)
+    job->attr[i] =
+      OBJ_TRANSPARENT[i] ? CTR_LIGHT_JOB_TRANSPARENT : ctr_world_light_emission (i);
+
+  for (i = 0; i < chunks; i++)
+    {
+      ctr_chunk *chnk = QUERY_CONTEXT.chunks[i];
+      job->versions[i] = chnk ? chnk->version + 1 : 0;
+      if (!chnk)
+        continue;
+
+      if (chnk->packed)
+        ctr_chunk_unpack (chnk);
+      memcpy (&(job->type[i * CHUNK_ALEN]), chnk->cells->type,
+              CHUNK_ALEN * sizeof (unsigned short));
+      memcpy (&(job->light[i * CHUNK_ALEN]), chnk->cells->light, CHUNK_ALEN);
+    }
+
+  ctr_world_query_desetup (1);
+  QUERY_DONE ();
+}
+
+/* Lays the cells of the copied chunks out in the grid (light and attr),
+ * or with back set copies the light of the grid back into them and marks
+ * the changed chunks. The cells of missing chunks are dark and never
+ * changed, just like the outermost cells of the grid.
+ */
+static void ctr_light_job_grid (ctr_light_job *job, unsigned char *light, unsigned char *attr, int back)
+{
+  int cx, cy, cz, x, y, z, w = CTR_LIGHT_JOB_W - 1;
+  unsigned int i = 0, j;
+
+  if (!back)
+    {
+      memset (light, 0, CTR_LIGHT_JOB_LEN);
+      memset (attr,  0, CTR_LIGHT_JOB_LEN);
+    }
+
+  for (cz = 0; cz < job->chunks_w; cz++)
+    for (cy = 0; cy < job->chunks_w; cy++)
+      for (cx = 0; cx < job->chunks_w; cx++, i++)
+        {
+          if (!job->versions[i])
+            continue;
+
+          // the position of the chunk in the grid and the part in it:
+          int ox = (job->cx + cx) * CHUNK_SIZE - job->x,
+              oy = (job->cy + cy) * CHUNK_SIZE - job->y,
+              oz = (job->cz + cz) * CHUNK_SIZE - job->z;
+          int x0 = ox < 0 ? -ox : 0, x1 = ox + CHUNK_SIZE - 1 > w ? w - ox : CHUNK_SIZE - 1,
+              y0 = oy < 0 ? -oy : 0, y1 = oy + CHUNK_SIZE - 1 > w ? w - oy : CHUNK_SIZE - 1,
+              z0 = oz < 0 ? -oz : 0, z1 = oz + CHUNK_SIZE - 1 > w ? w - oz : CHUNK_SIZE - 1;
+          unsigned int len = x1 - x0 + 1;
+
+          for (z = z0; z <= z1; z++)
+            for (y = y0; y <= y1; y++)
+              {
+                unsigned int offs = i * CHUNK_ALEN + REL_POS2OFFS (x0, y, z),
+                             idx  = CTR_LIGHT_JOB_IDX (ox + x0, oy + y, oz + z);
+
+                if (back)
+                  {
+                    if (memcmp (&(job->light[offs]), &(light[idx]), len))
+                      {
+                        memcpy (&(job->light[offs]), &(light[idx]), len);
+                        job->changed[i] = 1;
+                      }
+                    continue;
+                  }
+
+                memcpy (&(light[idx]), &(job->light[offs]), len);
+                for (j = 0; j < len; j++)
+                  attr[idx + j] = job->attr[job->type[offs + j]];
+              }
+        }
+
+  if (back)
+    return;
+
+  for (z = 0; z <= w; z++)
+    for (y = 0; y <= w; y++)
+      for (x = 0; x <= w; x += (z == 0 || z == w || y == 0 || y == w) ? 1 : w)
+        attr[CTR_LIGHT_JOB_IDX (x, y, z)] = 0;
+}
+
+/* Computes the light of the job, see ctr_world_query_relight_box (). This
+ * is the part that runs on the workers, it only touches the job and the
+ * scratch space of the worker (see ctr_light_worker).
+ */
+static void ctr_light_job_run (ctr_light_job *job, unsigned char *light, unsigned char *attr, unsigned int *frontier, unsigned int *seeds)
+{
+  static const int step[6] = {
+    -1, 1,
+    -CTR_LIGHT_JOB_W, CTR_LIGHT_JOB_W,
+    -CTR_LIGHT_JOB_W * CTR_LIGHT_JOB_W, CTR_LIGHT_JOB_W * CTR_LIGHT_JOB_W,
+  };
+  int p = CTR_LIGHT_JOB_PAD, e = CTR_LIGHT_JOB_PAD + CTR_LIGHT_JOB_BOX - 1;
+  unsigned int cnt[16], end[16], idx;
+  int x, y, z, pass, l;
+
+  ctr_light_job_grid (job, light, attr, 0);
+
+  // darken the sector, light sources get the light they emit:
+  for (z = p; z <= e; z++)
+    for (y = p; y <= e; y++)
+      for (x = p, idx = CTR_LIGHT_JOB_IDX (x, y, z); x <= e; x++, idx++)
+        light[idx] = attr[idx] & CTR_LIGHT_JOB_TRANSPARENT ? 0 : attr[idx] & 0x0F;
+
+  /* The seeds are the light sources of the sector and the lit cells right
+   * next to it, sorted by light: the first pass counts them, the second
+   * one puts them in place.
+   */
+  memset (cnt, 0, sizeof (cnt));
+  for (pass = 0; pass < 2; pass++)
+    {
+      if (pass)
+        for (l = 0, end[0] = 0; l < 16; l++)
+          end[l] = (l > 0 ? end[l - 1] : 0) + cnt[l];
+
+      for (z = p - 1; z <= e + 1; z++)
+        for (y = p - 1; y <= e + 1; y++)
+          for (x = p - 1; x <= e + 1; x++)
+            {
+              int out = (x < p || x > e) + (y < p || y > e) + (z < p || z > e);
+              idx = CTR_LIGHT_JOB_IDX (x, y, z);
+              if (out > 1 || light[idx] < 2)
+                continue;
+
+              if (pass)
+                seeds[--end[light[idx]]] = idx;
+              else
+                cnt[light[idx]]++;
+            }
+    }
+
+  /* Spread the light level by level, brightest first. A cell is set and
+   * queued only once, so frontier can't overflow.
+   */
+  unsigned int head = 0, tail = 0, i, lvl_end;
+  for (l = 15; l > 1; l--)
+    {
+      // a seed might have been lit brighter from somewhere else:
+      for (i = end[l]; i < end[l] + cnt[l]; i++)
+        if (light[seeds[i]] == l)
+          frontier[tail++] = seeds[i];
+
+      lvl_end = tail;
+      while (head < lvl_end)
+        {
+          idx = frontier[head++];
+          for (i = 0; i < 6; i++)
+            {
+              unsigned int n = idx + step[i];
+              if (!(attr[n] & CTR_LIGHT_JOB_TRANSPARENT) || light[n] >= l - 1)
+                continue;
+
+              light[n] = l - 1;
+              if (l - 1 > 1)
+                frontier[tail++] = n;
+            }
+        }
+    }
+
+  ctr_light_job_grid (job, light, attr, 1);
+}
+
+/* Copies the light of the changed chunks back into the world and reports
+ * them, on the main thread. Returns 0 if a chunk was changed since the job
+ * copied it, then nothing is written.
+ */
+static int ctr_light_job_commit (ctr_light_job *job)
+{
+  static unsigned char old_light[CHUNK_ALEN];
+
+  QUERY_USE_FIXED (&ctr_light_job_query);
+  ctr_light_job_query_setup (job);
+
+  unsigned int i;
+  for (i = 0; i < ctr_light_job_chunks (job); i++)
+    {
+      ctr_chunk *chnk = QUERY_CONTEXT.chunks[i];
+      if ((chnk ? chnk->version + 1 : 0) != job->versions[i])
+        {
+          ctr_world_query_desetup (1);
+          QUERY_DONE ();
+          return 0;
+        }
+    }
+
+  for (i = 0; i < ctr_light_job_chunks (job); i++)
+    {
+      ctr_chunk *chnk = QUERY_CONTEXT.chunks[i];
+      if (!job->changed[i])
+        continue;
+
+      if (chnk->packed)
+        ctr_chunk_unpack (chnk);
+      ctr_chunk_unshare (chnk);
+      memcpy (old_light, chnk->cells->light, CHUNK_ALEN);
+      memcpy (chnk->cells->light, &(job->light[i * CHUNK_ALEN]), CHUNK_ALEN);
+      ctr_chunk_light_changed (chnk, old_light);
+    }
+
+  ctr_world_query_desetup (0);
+  QUERY_DONE ();
+  return 1;
+}
+
+static ctr_light_job *ctr_light_job_new (int sx, int sy, int sz)
+{
+  ctr_light_job *job = safemalloc (sizeof (ctr_light_job));
+  job->sx = sx;
+  job->sy = sy;
+  job->sz = sz;
+  job->x  = sx * CTR_LIGHT_JOB_BOX - CTR_LIGHT_JOB_PAD;
+  job->y  = sy * CTR_LIGHT_JOB_BOX - CTR_LIGHT_JOB_PAD;
+  job->z  = sz * CTR_LIGHT_JOB_BOX - CTR_LIGHT_JOB_PAD;
+  job->cx = CHUNK_DIV (job->x);
+  job->cy = CHUNK_DIV (job->y);
+  job->cz = CHUNK_DIV (job->z);
+  job->chunks_w = CHUNK_DIV (job->x + CTR_LIGHT_JOB_W - 1) - job->cx + 1;
+
+  unsigned int chunks = ctr_light_job_chunks (job);
+  job->versions = safemalloc (sizeof (unsigned long long) * chunks);
+  job->changed  = safemalloc (chunks);
+  job->type     = 0; // allocated by the first ctr_light_job_copy ()
+  job->light    = 0;
+  job->next  = 0;
+  job->pending_next = 0;
+  job->running = 0;
+  return job;
+}
+
+static void ctr_light_job_free (ctr_light_job *job)
+{
+  safefree (job->changed);
+  if (job->type)
+    {
+      safefree (job->light);
+      safefree (job->type);
+    }
+  safefree (job->versions);
+  safefree (job);
+}
+
+#if CTR_LIGHT_THREADS
+
+typedef struct _ctr_light_worker {
+    pthread_t thread;
+    unsigned char *light, *attr;
+    unsigned int  *frontier, *seeds;
+} ctr_light_worker;
+
+static ctr_light_worker *ctr_light_workers     = 0;
+static int               ctr_light_workers_cnt = 0;
+static int               ctr_light_workers_quit;
+
+// The queue of jobs to run and the list of finished ones, under the mutex:
+static pthread_mutex_t ctr_light_jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  ctr_light_jobs_cond  = PTHREAD_COND_INITIALIZER;
+static ctr_light_job  *ctr_light_jobs_todo, *ctr_light_jobs_todo_last;
+static ctr_light_job  *ctr_light_jobs_done;
+
+static ctr_light_job  *ctr_light_jobs_pending; // main thread only, in order
+static int             ctr_light_jobs_running; // main thread only
+
+static int ctr_light_jobs_pipe[2] = { -1, -1 };
+
+static void *ctr_light_worker_loop (void *arg)
+{
+  ctr_light_worker *w = arg;
+
+  pthread_mutex_lock (&ctr_light_jobs_mutex);
+  for (;;)
+    {
+      while (!ctr_light_jobs_todo && !ctr_light_workers_quit)
+        pthread_cond_wait (&ctr_light_jobs_cond, &ctr_light_jobs_mutex);
+      if (ctr_light_workers_quit)
+        break;
+
+      ctr_light_job *job = ctr_light_jobs_todo;
+      ctr_light_jobs_todo = job->next;
+      pthread_mutex_unlock (&ctr_light_jobs_mutex);
+
+      ctr_light_job_run (job, w->light, w->attr, w->frontier, w->seeds);
+
+      pthread_mutex_lock (&ctr_light_jobs_mutex);
+      job->next = ctr_light_jobs_done;
+      ctr_light_jobs_done = job;
+
+      // the pipe is non blocking, a full pipe wakes up the loop anyways:
+      char b = 0;
+      if (write (ctr_light_jobs_pipe[1], &b, 1) < 0)
+        ;
+    }
+  pthread_mutex_unlock (&ctr_light_jobs_mutex);
+
+  return 0;
+}
+
+static void ctr_light_jobs_push (ctr_light_job *job)
+{
+  pthread_mutex_lock (&ctr_light_jobs_mutex);
+  job->next = 0;
+  if (ctr_light_jobs_todo)
+    ctr_light_jobs_todo_last->next = job;
+  else
+    ctr_light_jobs_todo = job;
+  ctr_light_jobs_todo_last = job;
+  pthread_cond_signal (&ctr_light_jobs_cond);
+  pthread_mutex_unlock (&ctr_light_jobs_mutex);
+}
+
+/* Copies and runs the jobs that don't overlap a running one, at most one
+ * per worker so that the copies don't pile up.
+ */
+static void ctr_light_jobs_dispatch ()
+{
+  ctr_light_job *job, *r;
+  for (job = ctr_light_jobs_pending;
+       job && ctr_light_jobs_running < ctr_light_workers_cnt;
+       job = job->pending_next)
+    {
+      if (job->running)
+        continue;
+
+      for (r = ctr_light_jobs_pending; r; r = r->pending_next)
+        if (r->running
+            && abs (r->sx - job->sx) <= 1
+            && abs (r->sy - job->sy) <= 1
+            && abs (r->sz - job->sz) <= 1)
+          break;
+      if (r)
+        continue;
+
+      ctr_light_job_copy (job);
+      job->running = 1;
+      ctr_light_jobs_running++;
+      ctr_light_jobs_push (job);
+    }
+}
+
+#endif
+
+/* Commits the finished light jobs, see above. Jobs whose chunks changed
+ * in the meantime are queued again. Returns the number of committed jobs.
+ */
+int ctr_world_light_jobs_commit ()
+{
+  int cnt = 0;
+#if CTR_LIGHT_THREADS
+  if (ctr_light_jobs_pipe[0] >= 0)
+    {
+      char buf[256];
+      while (read (ctr_light_jobs_pipe[0], buf, sizeof (buf)) > 0)
+        ;
+    }
+
+  pthread_mutex_lock (&ctr_light_jobs_mutex);
+  ctr_light_job *job = ctr_light_jobs_done;
+  ctr_light_jobs_done = 0;
+  pthread_mutex_unlock (&ctr_light_jobs_mutex);
+
+  while (job)
+    {
+      ctr_light_job *next = job->next;
+      if (ctr_light_job_commit (job))
+        {
+          ctr_light_job **p = &ctr_light_jobs_pending;
+          while (*p != job)
+            p = &((*p)->pending_next);
+          *p = job->pending_next;
+
+          ctr_light_jobs_running--;
+          ctr_light_job_free (job);
+          cnt++;
+        }
+      else
+        {
+          ctr_light_job_copy (job);
+          ctr_light_jobs_push (job);
+        }
+      job = next;
+    }
+
+  ctr_light_jobs_dispatch ();
+#endif
+  return cnt;
+}
+
+// Returns the number of light jobs that are not committed yet.
+int ctr_world_light_jobs_pending ()
+{
+#if CTR_LIGHT_THREADS
+  int cnt = 0;
+  ctr_light_job *job;
+  for (job = ctr_light_jobs_pending; job; job = job->pending_next)
+    cnt++;
+  return cnt;
+#else
+  return 0;
+#endif
+}
+
+// Returns 1 if the light job of the sector is not committed yet.
+int ctr_world_light_sector_pending (int sx, int sy, int sz)
+{
+#if CTR_LIGHT_THREADS
+  ctr_light_job *job;
+  for (job = ctr_light_jobs_pending; job; job = job->pending_next)
+    if (job->sx == sx && job->sy == sy && job->sz == sz)
+      return 1;
+#endif
+  return 0;
+}
+
+/* Lights the sector on a worker, or right away without workers. Returns 1
+ * if a job was queued.
+ */
+int ctr_world_light_sector_job (int sx, int sy, int sz)
+{
+  ctr_light_job *job = ctr_light_job_new (sx, sy, sz);
+
+#if CTR_LIGHT_THREADS
+  if (ctr_light_workers_cnt > 0)
+    {
+      ctr_light_job **p = &ctr_light_jobs_pending;
+      while (*p)
+        p = &((*p)->pending_next);
+      *p = job;
+
+      ctr_light_jobs_dispatch ();
+      return 1;
+    }
+#endif
+
+  ctr_light_job_copy (job);
+
+  unsigned char *light    = safemalloc (CTR_LIGHT_JOB_LEN),
+                *attr     = safemalloc (CTR_LIGHT_JOB_LEN);
+  unsigned int  *frontier = safemalloc (sizeof (unsigned int) * CTR_LIGHT_JOB_LEN),
+                *seeds    = safemalloc (sizeof (unsigned int) * CTR_LIGHT_JOB_LEN);
+  ctr_light_job_run (job, light, attr, frontier, seeds);
+  ctr_light_job_commit (job);
+  safefree (seeds);
+  safefree (frontier);
+  safefree (attr);
+  safefree (light);
+  ctr_light_job_free (job);
+  return 0;
+}
+
+/* Stops the workers (after finishing and committing all their jobs) and
+ * starts cnt new ones. Returns the file descriptor the event loop should
+ * watch to call ctr_world_light_jobs_commit (), or -1 without workers.
+ */
+int ctr_world_light_workers (int cnt)
+{
+#if CTR_LIGHT_THREADS
+  int i;
+
+  while (ctr_light_jobs_pending)
+    {
+      if (ctr_light_workers_cnt == 0)
+        croak ("Games::Construder: light jobs pending without workers");
+      usleep (1000);
+      ctr_world_light_jobs_commit ();
+    }
+
+  if (ctr_light_workers_cnt > 0)
+    {
+      pthread_mutex_lock (&ctr_light_jobs_mutex);
+      ctr_light_workers_quit = 1;
+      pthread_cond_broadcast (&ctr_light_jobs_cond);
+      pthread_mutex_unlock (&ctr_light_jobs_mutex);
+
+      for (i = 0; i < ctr_light_workers_cnt; i++)
+        {
+          pthread_join (ctr_light_workers[i].thread, 0);
+          safefree (ctr_light_workers[i].light);
+          safefree (ctr_light_workers[i].attr);
+          safefree (ctr_light_workers[i].frontier);
+          safefree (ctr_light_workers[i].seeds);
+        }
+      safefree (ctr_light_workers);
+      ctr_light_workers = 0;
+      ctr_light_workers_cnt = 0;
+      ctr_light_workers_quit = 0;
+    }
+
+  if (cnt <= 0)
+    return -1;
+
+  if (ctr_light_jobs_pipe[0] < 0)
+    {
+      if (pipe (ctr_light_jobs_pipe))
+        croak ("Games::Construder: couldn't create the light job pipe: %s",
+               strerror (errno));
+      fcntl (ctr_light_jobs_pipe[0], F_SETFL, O_NONBLOCK);
+      fcntl (ctr_light_jobs_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+  ctr_light_workers = safemalloc (sizeof (ctr_light_worker) * cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      ctr_light_worker *w = &(ctr_light_workers[i]);
+      w->light    = safemalloc (CTR_LIGHT_JOB_LEN);
+      w->attr     = safemalloc (CTR_LIGHT_JOB_LEN);
+      w->frontier = safemalloc (sizeof (unsigned int) * CTR_LIGHT_JOB_LEN);
+      w->seeds    = safemalloc (sizeof (unsigned int) * CTR_LIGHT_JOB_LEN);
+      if (pthread_create (&(w->thread), 0, ctr_light_worker_loop, w))
+        {
+          safefree (w->light);
+          safefree (w->attr);
+          safefree (w->frontier);
+          safefree (w->seeds);
+          break;
+        }
+    }
+  ctr_light_workers_cnt = i;
+
+  return i > 0 ? ctr_light_jobs_pipe[0] : -1;
+#else
+  return -1;
+#endif
+}
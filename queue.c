@@ -17,6 +17,7 @@
  */
 /* This file holds a primitive queue implementation.
  * Mainly used by the light algorithm at the moment of this writing.
+ * The queue is a ring buffer, which doubles its size when it's full.
  */
 typedef struct _ctr_queue {
     unsigned char *data;
@@ -31,6 +32,8 @@ void ctr_queue_clear (ctr_queue *q)
 {
   q->start = q->data;
   q->end   = q->data;
+  q->freeze_start = 0;
+  q->freeze_end   = 0;
 }
 
 ctr_queue *ctr_queue_new (unsigned int item_size, unsigned int alloc_items)
@@ -62,6 +65,36 @@ void ctr_queue_free (ctr_queue *q)
   safefree (q);
 }
 
+/* Doubles the size of the full queue q. The items (including the dequeued
+ * ones a frozen queue still needs, see below) are moved to the start of
+ * the new buffer in order.
+ */
+static void ctr_queue_grow (ctr_queue *q)
+{
+  unsigned char *keep = q->freeze_start ? q->freeze_start : q->start;
+  unsigned int   len  = q->data_end - q->data;
+
+  unsigned char *data = safemalloc (len * 2);
+  memcpy (data, keep, q->data_end - keep);
+  memcpy (data + (q->data_end - keep), q->data, keep - q->data);
+
+#define CTR_QUEUE_MOVE(p) \
+  (data + ((p) >= keep ? (p) - keep : (p) - q->data + (q->data_end - keep)))
+  q->start = CTR_QUEUE_MOVE (q->start);
+  if (q->freeze_start)
+    {
+      q->freeze_start = CTR_QUEUE_MOVE (q->freeze_start);
+      q->freeze_end   = CTR_QUEUE_MOVE (q->freeze_end);
+    }
+#undef CTR_QUEUE_MOVE
+  q->end = data + len;
+
+  safefree (q->data);
+  q->data        = data;
+  q->data_end    = data + len * 2;
+  q->alloc_items *= 2;
+}
+
 void ctr_queue_enqueue (ctr_queue *q, void *item)
 {
   memcpy (q->end, item, q->item_size);
@@ -69,14 +102,15 @@ void ctr_queue_enqueue (ctr_queue *q, void *item)
   q->end += q->item_size;
 
   if (q->end == q->data_end) // wrap pointer
-    {
-      q->end = q->data;
-      assert (q->start != q->end);
-    }
+    q->end = q->data;
+
+  if (q->end == (q->freeze_start ? q->freeze_start : q->start))
+    ctr_queue_grow (q);
 }
 
 /* This function stores the state of the queue, so
  * we can quickly restore the queue using the queue_thaw method.
+ * The queue keeps the items dequeued after this until it's cleared.
  */
 void ctr_queue_freeze (ctr_queue *q)
 {
@@ -217,6 +217,7 @@ void ctr_render_cleanup_geom (void *c)
 #define GEOM_PRE_ALLOC 150 // enought for radius of 3 (~93 visible chunks)
 static ctr_render_geom *geom_pre_alloc[GEOM_PRE_ALLOC];
 static int              geom_last_free = 0;
+static ctr_slab         geom_slab;
 
 void *ctr_render_new_geom ()
 {
@@ -229,7 +230,10 @@ void *ctr_render_new_geom ()
     }
   else
     {
-      c = safemalloc (sizeof (ctr_render_geom));
+      if (!geom_slab.item_size)
+        ctr_slab_init (&geom_slab, "render geometry", sizeof (ctr_render_geom));
+
+      c = ctr_slab_alloc (&geom_slab);
       ctr_prof_cnt.geom_cnt++;
       memset (c, 0, sizeof (ctr_render_geom));
       c->dl = glGenLists (1);
@@ -311,7 +315,7 @@ void ctr_render_free_geom (void *c)
       ctr_dyn_buf_free (&geom->db_colors);
       ctr_dyn_buf_free (&geom->db_uvs);
 #endif
-      safefree (geom);
+      ctr_slab_free (&geom_slab, geom);
       ctr_prof_cnt.geom_cnt--;
     }
 }
@@ -603,10 +607,10 @@ void ctr_render_model (unsigned int type, unsigned short color, double light, do
     return;
 }
 
-// Computes the light of a cell.
-double ctr_cell_light (ctr_cell *c)
+// Computes the light of a cell from its light level.
+double ctr_cell_light (unsigned char light_level)
 {
-  double light = (double) c->light / 15;
+  double light = (double) light_level / 15;
   if (light < ctr_ambient_light)
     light = ctr_ambient_light;
   return light;
@@ -621,70 +625,102 @@ int ctr_render_chunk (int x, int y, int z, void *geom)
   if (!c)
     return 0;
 
-  LOAD_NEIGHBOUR_CHUNKS(x,y,z);
+  CTR_PROF_BEGIN (t_start);
 
   ctr_render_geom *g = geom;
   g->xoff = x * CHUNK_SIZE;
   g->yoff = y * CHUNK_SIZE;
   g->zoff = z * CHUNK_SIZE;
 
+  ctr_chunk_visibility (c);
+
+  // empty and buried chunks have no faces, don't bother with the cells:
+  ctr_chunk_summary (c);
+  if (c->nonair == 0 || ctr_chunk_buried (c))
+    {
+      ctr_render_compile_geom (geom);
+      CTR_PROF_END (CTR_PROF_MESH, t_start);
+      return 1;
+    }
+
+  // the faces on the border need the cells of the neighbour chunks:
+  ctr_chunk_halo *h = ctr_chunk_halo_get (c, CTR_HALO_NEIGHBOURS | CTR_HALO_LIGHT);
+
   //d// ctr_world_chunk_calc_visibility (c);
 
+  unsigned char *transp = h->transparent;
+  unsigned char *light  = h->light;
+
   int ix, iy, iz;
   for (iz = 0; iz < CHUNK_SIZE; iz++)
     for (iy = 0; iy < CHUNK_SIZE; iy++)
-      for (ix = 0; ix < CHUNK_SIZE; ix++)
-        {
-          int dx = ix + g->xoff;
-          int dy = iy + g->yoff;
-          int dz = iz + g->zoff;
-
-          ctr_cell *cur = ctr_world_chunk_neighbour_cell (c, ix, iy, iz, 0);
-          if (!cur->visible)// || ctr_world_cell_transparent (cur))
-            continue;
-
-          ctr_obj_attr *oa = ctr_world_get_attr (cur->type);
-          if (!oa->has_txt)
-            {
-              // blocks without texture probably have a model:
-              ctr_render_model (
-                cur->type, cur->add & 0x0F, ctr_cell_light (cur), dx, dy, dz, geom, -1, 0, 1);
+      {
+        unsigned int offs  = REL_POS2OFFS (0, iy, iz);
+        unsigned int hoffs = HALO_OFFS (0, iy, iz);
+        for (ix = 0; ix < CHUNK_SIZE; ix++, offs++, hoffs++)
+          {
+            if (!CELL_VISIBLE (c, offs))
               continue;
-            }
 
-          GET_NEIGHBOURS(c, ix, iy, iz);
-
-          if (ctr_world_cell_transparent (front))
-            ctr_render_add_face (
-              0, cur->type, cur->add & 0x0F, ctr_cell_light (front),
-              dx, dy, dz, 1, 0, 0, 0, geom);
-
-          if (ctr_world_cell_transparent (top))
-            ctr_render_add_face (
-              1, cur->type, cur->add & 0x0F, ctr_cell_light (top),
-              dx, dy, dz, 1, 0, 0, 0, geom);
-
-          if (ctr_world_cell_transparent (back))
-            ctr_render_add_face (
-              2, cur->type, cur->add & 0x0F, ctr_cell_light (back),
-              dx, dy, dz, 1, 0, 0, 0, geom);
-
-          if (ctr_world_cell_transparent (left))
-            ctr_render_add_face (
-              3, cur->type, cur->add & 0x0F, ctr_cell_light (left),
-              dx, dy, dz, 1, 0, 0, 0, geom);
-
-          if (ctr_world_cell_transparent (right))
-            ctr_render_add_face (
-              4, cur->type, cur->add & 0x0F, ctr_cell_light (right),
-              dx, dy, dz, 1, 0, 0, 0, geom);
-
-          if (ctr_world_cell_transparent (bot))
-            ctr_render_add_face (
-              5, cur->type, cur->add & 0x0F, ctr_cell_light (bot),
-              dx, dy, dz, 1, 0, 0, 0, geom);
-        }
+            int dx = ix + g->xoff;
+            int dy = iy + g->yoff;
+            int dz = iz + g->zoff;
+
+            unsigned short type  = h->type[hoffs];
+            unsigned char  color = CELL_ADD (c, offs) & 0x0F;
+            ctr_obj_attr *oa = ctr_world_get_attr (type);
+            if (!oa->has_txt)
+              {
+                // blocks without texture probably have a model:
+                ctr_render_model (
+                  type, color, ctr_cell_light (light[hoffs]),
+                  dx, dy, dz, geom, -1, 0, 1);
+                continue;
+              }
+
+            unsigned int n;
+
+            n = hoffs - HALO_DZ; // front
+            if (transp[n])
+              ctr_render_add_face (
+                0, type, color, ctr_cell_light (light[n]),
+                dx, dy, dz, 1, 0, 0, 0, geom);
+
+            n = hoffs + HALO_DY; // top
+            if (transp[n])
+              ctr_render_add_face (
+                1, type, color, ctr_cell_light (light[n]),
+                dx, dy, dz, 1, 0, 0, 0, geom);
+
+            n = hoffs + HALO_DZ; // back
+            if (transp[n])
+              ctr_render_add_face (
+                2, type, color, ctr_cell_light (light[n]),
+                dx, dy, dz, 1, 0, 0, 0, geom);
+
+            n = hoffs - HALO_DX; // left
+            if (transp[n])
+              ctr_render_add_face (
+                3, type, color, ctr_cell_light (light[n]),
+                dx, dy, dz, 1, 0, 0, 0, geom);
+
+            n = hoffs + HALO_DX; // right
+            if (transp[n])
+              ctr_render_add_face (
+                4, type, color, ctr_cell_light (light[n]),
+                dx, dy, dz, 1, 0, 0, 0, geom);
+
+            n = hoffs - HALO_DY; // bottom
+            if (transp[n])
+              ctr_render_add_face (
+                5, type, color, ctr_cell_light (light[n]),
+                dx, dy, dz, 1, 0, 0, 0, geom);
+          }
+      }
+
+  ctr_chunk_halo_put (h);
 
   ctr_render_compile_geom (geom);
+  CTR_PROF_END (CTR_PROF_MESH, t_start);
   return 1;
 }
@@ -0,0 +1,158 @@
+/*
+ * Games::Construder - A 3D Game written in Perl with an infinite and modifiable world.
+ * Copyright (C) 2011  Robin Redeker
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* This file holds a simple slab allocator for the fixed size objects
+ * that are allocated and freed a lot while sectors are loaded and
+ * unloaded (chunks, their cells, render geometry).
+ *
+ * Each slab carves items of one size out of large pages it gets directly
+ * from the OS, freed items are kept on a free list and are reused. Pages
+ * are never given back, so the heap doesn't fragment while the world
+ * churns, and the memory of all slabs together can be limited by a
+ * budget, see ctr_slab_set_budget ().
+ */
+#include <sys/mman.h>
+
+#define CTR_SLAB_PAGE_SIZE      (1024 * 1024)
+#define CTR_SLAB_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define CTR_SLAB_ALIGN          16
+
+typedef struct _ctr_slab {
+    const char    *name;
+    unsigned int   item_size;
+    void          *free_list;    // freed items, linked by their first word
+    unsigned char *page_pos;     // next never used item of the current page
+    unsigned char *page_end;
+    unsigned int   live;         // items handed out
+    unsigned int   pages;
+} ctr_slab;
+
+static unsigned long ctr_slab_budget     = 0; // in bytes, 0 means unlimited
+static unsigned long ctr_slab_reserved   = 0; // bytes of all pages
+static unsigned long ctr_slab_live       = 0; // bytes of all live items
+static int           ctr_slab_huge_pages = 0;
+
+/* Sets the maximum number of bytes that all slabs together may reserve,
+ * and whether new pages should be backed by huge pages.
+ */
+void ctr_slab_set_budget (unsigned long bytes, int huge_pages)
+{
+  ctr_slab_budget     = bytes;
+  ctr_slab_huge_pages = huge_pages;
+}
+
+void ctr_slab_init (ctr_slab *s, const char *name, unsigned int item_size)
+{
+  memset (s, 0, sizeof (ctr_slab));
+  if (item_size < sizeof (void *))
+    item_size = sizeof (void *);
+  s->name      = name;
+  s->item_size = (item_size + CTR_SLAB_ALIGN - 1) & ~(CTR_SLAB_ALIGN - 1);
+}
+
+static void ctr_slab_update_counters ()
+{
+  if (ctr_slab_live > ctr_prof_cnt.slab_high_water)
+    ctr_prof_cnt.slab_high_water = ctr_slab_live;
+  ctr_prof_cnt.slab_live     = ctr_slab_live;
+  ctr_prof_cnt.slab_free     = ctr_slab_reserved - ctr_slab_live;
+  ctr_prof_cnt.slab_reserved = ctr_slab_reserved;
+}
+
+// Returns 0 if the page would exceed the memory budget.
+static int ctr_slab_new_page (ctr_slab *s)
+{
+  unsigned long size =
+    ctr_slab_huge_pages ? CTR_SLAB_HUGE_PAGE_SIZE : CTR_SLAB_PAGE_SIZE;
+  if (size < s->item_size)
+    size = (s->item_size + size - 1) & ~(size - 1);
+
+  if (ctr_slab_budget && ctr_slab_reserved + size > ctr_slab_budget)
+    return 0;
+
+  void *page = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (ctr_slab_huge_pages)
+    page = mmap (0, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (page == MAP_FAILED)
+    {
+      page = mmap (0, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (page == MAP_FAILED)
+        croak ("Games::Construder: couldn't map %lu bytes for a %s: %s",
+               size, s->name, strerror (errno));
+#ifdef MADV_HUGEPAGE
+      // no reserved huge pages, ask for transparent ones instead:
+      if (ctr_slab_huge_pages)
+        madvise (page, size, MADV_HUGEPAGE);
+#endif
+    }
+
+  s->page_pos = page;
+  s->page_end = s->page_pos + (size / s->item_size) * s->item_size;
+  s->pages++;
+  ctr_slab_reserved += size;
+  return 1;
+}
+
+// Returns a new item, or 0 if the memory budget is exhausted.
+void *ctr_slab_try_alloc (ctr_slab *s)
+{
+  void *item = s->free_list;
+  if (item)
+    s->free_list = *((void **) item);
+  else
+    {
+      if (s->page_pos >= s->page_end && !ctr_slab_new_page (s))
+        return 0;
+      item = s->page_pos;
+      s->page_pos += s->item_size;
+    }
+
+  s->live++;
+  ctr_slab_live += s->item_size;
+  ctr_slab_update_counters ();
+  return item;
+}
+
+void ctr_slab_budget_exceeded (ctr_slab *s)
+{
+  croak ("Games::Construder: memory budget of %lu bytes exceeded "
+         "(%lu bytes reserved) while allocating a %s",
+         ctr_slab_budget, ctr_slab_reserved, s->name);
+}
+
+// Like ctr_slab_try_alloc (), but croaks if the memory budget is exhausted.
+void *ctr_slab_alloc (ctr_slab *s)
+{
+  void *item = ctr_slab_try_alloc (s);
+  if (!item)
+    ctr_slab_budget_exceeded (s);
+  return item;
+}
+
+void ctr_slab_free (ctr_slab *s, void *item)
+{
+  *((void **) item) = s->free_list;
+  s->free_list = item;
+
+  s->live--;
+  ctr_slab_live -= s->item_size;
+  ctr_slab_update_counters ();
+}
@@ -0,0 +1,194 @@
+#!perl
+# Lights big open caverns, with thousands of light sources, and removes
+# a lot of them again. The light queues have to grow way beyond their
+# initial size for this, and the result has to follow the light rules:
+# a light source has the light it emits, any other solid cell is dark
+# and a transparent cell has the maximum light of its neighbours minus 1.
+use strict;
+use warnings;
+use Test::More tests => 10;
+use Games::Construder;
+
+my $CS  = Games::Construder::World::chunk_size ();
+my $CPS = Games::Construder::World::chunks_per_sector ();
+my $S   = $CS * $CPS;
+
+Games::Construder::World::init (sub { }, sub { });
+Games::Construder::World::set_object_type ($_, 0, 1, 1, 0, 0, 0, 0, 0) for 1..100;
+Games::Construder::World::set_object_type (0, 1, 0, 0, 0, 0, 0, 0, 0);
+Games::Construder::VolDraw::init ();
+
+my %EMIT = (41 => 8, 35 => 12, 40 => 15);
+
+# empty sectors, all air:
+my @SECS = ([0, 0, 0], [1, 0, 0]);
+for (@SECS) {
+   Games::Construder::VolDraw::alloc ($S);
+   Games::Construder::VolDraw::dst_to_world (@$_, []);
+   Games::Construder::World::query_desetup (1);
+}
+
+sub sector_query {
+   my ($sec) = @_;
+   my $ll = [map { $_ * $S } @$sec];
+   Games::Construder::World::flow_light_query_setup (@$ll, map { $_ + $S - 1 } @$ll);
+   $ll
+}
+
+# sets the cells in the box of the sector (sector relative) to type t
+# where the coordinates are multiples of step:
+sub fill_lattice {
+   my ($sec, $from, $to, $step, $t) = @_;
+   my $ll = sector_query ($sec);
+   for my $x ($from..$to) {
+      for my $y ($from..$to) {
+         for my $z ($from..$to) {
+            next if $x % $step || $y % $step || $z % $step;
+            Games::Construder::World::query_set_at_abs (
+               $ll->[0] + $x, $ll->[1] + $y, $ll->[2] + $z, [$t, 0, 0, 0, 0]);
+         }
+      }
+   }
+   Games::Construder::World::query_desetup (1);
+}
+
+sub relight_sector {
+   my ($sec) = @_;
+   sector_query ($sec);
+   Games::Construder::World::flow_light_sector (@$sec);
+   Games::Construder::World::query_desetup (1);
+}
+
+# type and light of all cells of the sector, x + y * S + z * S * S:
+sub sector_cells {
+   my ($sec) = @_;
+   my (@type, @light);
+   for my $cz (0..$CPS - 1) {
+      for my $cy (0..$CPS - 1) {
+         for my $cx (0..$CPS - 1) {
+            my $data = Games::Construder::World::get_chunk_data (
+               $sec->[0] * $CPS + $cx, $sec->[1] * $CPS + $cy, $sec->[2] * $CPS + $cz);
+            my @d = unpack "C*", $data;
+            my $i = 0;
+            for my $z (0..$CS - 1) {
+               for my $y (0..$CS - 1) {
+                  my $o = ($cx * $CS) + ($cy * $CS + $y) * $S + ($cz * $CS + $z) * $S * $S;
+                  for my $x (0..$CS - 1) {
+                     $type[$o + $x]  = ($d[$i] << 4) | ($d[$i + 1] >> 4);
+                     $light[$o + $x] = $d[$i + 1] & 0x0F;
+                     $i += 4;
+                  }
+               }
+            }
+         }
+      }
+   }
+   (\@type, \@light)
+}
+
+# counts the cells (that have all their neighbours in the sector) whose
+# light is wrong:
+sub light_violations {
+   my ($sec) = @_;
+   my ($type, $light) = sector_cells ($sec);
+   my @step = (1, -1, $S, -$S, $S * $S, -$S * $S);
+   my $bad = 0;
+   for my $z (1..$S - 2) {
+      for my $y (1..$S - 2) {
+         for my $x (1..$S - 2) {
+            my $i = $x + $y * $S + $z * $S * $S;
+            my $want;
+            if ($type->[$i] == 0) {
+               $want = 0;
+               for (@step) {
+                  $want = $light->[$i + $_] if $light->[$i + $_] > $want;
+               }
+               $want-- if $want > 0;
+            } else {
+               $want = $EMIT{$type->[$i]} || 0;
+            }
+            $bad++ if $light->[$i] != $want;
+         }
+      }
+   }
+   $bad
+}
+
+sub sector_digest {
+   my ($sec) = @_;
+   join "", map {
+      my ($cx, $cy, $cz) = @$_;
+      Games::Construder::World::get_chunk_data (
+         $sec->[0] * $CPS + $cx, $sec->[1] * $CPS + $cy, $sec->[2] * $CPS + $cz)
+   } map { my $z = $_; map { my $y = $_; map { [$_, $y, $z] } 0..$CPS - 1 } 0..$CPS - 1 } 0..$CPS - 1
+}
+
+# a light every 3 cells, thousands of them, with a light level frontier
+# much bigger than a few chunks:
+fill_lattice ($_, 0, $S - 1, 3, 40) for @SECS;
+relight_sector ($_) for @SECS;
+is (light_violations ($SECS[0]), 0, "lattice of lights");
+is (light_violations ($SECS[1]), 0, "lattice of lights in the neighbour sector");
+
+# remove some of them one by one:
+{
+   my $ll = sector_query ($SECS[0]);
+   my $n = 0;
+   for my $x (map { $_ * 3 } 3..12) {
+      for my $y (map { $_ * 6 } 2..3) {
+         Games::Construder::World::query_set_at_abs (
+            $ll->[0] + $x, $ll->[1] + $y, $ll->[2] + 30, [0, 0, 0, 0, 0]);
+         Games::Construder::World::flow_light_at (
+            $ll->[0] + $x, $ll->[1] + $y, $ll->[2] + 30);
+         $n++;
+      }
+   }
+   Games::Construder::World::query_desetup (1);
+   is (light_violations ($SECS[0]), 0, "$n lights removed");
+}
+
+# one light in a huge empty cavern, removed again:
+fill_lattice ($SECS[0], 1, $S - 2, 1, 0);
+relight_sector ($SECS[0]);
+is (light_violations ($SECS[0]), 0, "empty cavern");
+{
+   my $ll = sector_query ($SECS[0]);
+   my @p = map { $_ + int ($S / 2) } @$ll;
+   for my $t (40, 0) {
+      Games::Construder::World::query_set_at_abs (@p, [$t, 0, 0, 0, 0]);
+      Games::Construder::World::flow_light_at (@p);
+   }
+   Games::Construder::World::query_desetup (1);
+   is (light_violations ($SECS[0]), 0, "single light set and removed");
+}
+
+# a huge edit: lights in most of the sector, relit as sector job:
+fill_lattice ($SECS[0], 2, $S - 3, 2, 35);
+sector_query ($SECS[0]);
+Games::Construder::World::query_desetup (1);
+Games::Construder::World::light_sector_job (@{$SECS[0]});
+is (light_violations ($SECS[0]), 0, "dense lattice lit by sector job");
+
+my $before = sector_digest ($SECS[0]);
+relight_sector ($SECS[0]);
+ok ($before eq sector_digest ($SECS[0]), "sector job and sector sweep agree");
+
+fill_lattice ($SECS[0], 2, $S - 3, 2, 0);
+relight_sector ($SECS[0]);
+is (light_violations ($SECS[0]), 0, "dense lattice removed");
+
+# a light relit in a box changes the light of a few cells, which are
+# recorded one by one:
+{
+   my $ll = sector_query ($SECS[1]);
+   my @p = map { $_ + 16 } @$ll;
+   my @chnk = map { int ($_ / $CS) } @p;
+   my ($version) = @{Games::Construder::World::get_chunk_changes (@chnk, 0)};
+   Games::Construder::World::query_set_at_abs (@p, [40, 0, 0, 0, 0]);
+   Games::Construder::World::flow_light_box ((map { $_ - 2 } @p), (map { $_ + 2 } @p));
+   Games::Construder::World::query_desetup (1);
+   my ($nversion, $changes) = @{Games::Construder::World::get_chunk_changes (@chnk, $version)};
+   ok (defined $changes && length $changes > 6, "light changes are in the change log")
+      or diag "version $version -> $nversion";
+   is (light_violations ($SECS[1]), 0, "light relit in a box");
+}
@@ -0,0 +1,54 @@
+#!perl
+# Exports a sector whose chunks all have the same data, but not all the
+# same cells, and imports it into another sector. Repeated chunks have
+# to refer to the chunk that carries the data, never to another repeat.
+use strict;
+use warnings;
+use Test::More tests => 6;
+use Games::Construder;
+
+my $CS  = Games::Construder::World::chunk_size ();
+my $CPS = Games::Construder::World::chunks_per_sector ();
+
+Games::Construder::World::init (sub { }, sub { });
+Games::Construder::World::set_object_type ($_, 0, 1, 1, 0, 0, 0, 0, 0) for 1..100;
+Games::Construder::World::set_object_type (0, 1, 0, 0, 0, 0, 0, 0, 0);
+
+sub sector_chunks {
+   map { my $x = $_; map { my $y = $_; map { [$x, $y, $_] } 0..$CPS - 1 } 0..$CPS - 1 } 0..$CPS - 1
+}
+
+sub sector_data {
+   my ($sec) = @_;
+   [map {
+      my $c = $_;
+      Games::Construder::World::get_chunk_data (map { $sec->[$_] * $CPS + $c->[$_] } 0..2)
+   } sector_chunks ()]
+}
+
+# all chunks of the sector share the cells of air:
+my $air = "\x00" x ($CS * $CS * $CS * 4);
+Games::Construder::World::set_chunk_data (@$_, $air, length $air)
+   for sector_chunks ();
+
+# the first chunk gets its own cells, with the same data again:
+Games::Construder::World::flow_light_query_setup (0, 0, 0, $CS - 1, $CS - 1, $CS - 1);
+for my $t (1, 0) {
+   Games::Construder::World::query_set_at_abs (1, 1, 1, [$t, 0, 0, 0, 0]);
+}
+Games::Construder::World::query_desetup (1);
+
+my $before = sector_data ([0, 0, 0]);
+is ($before->[0], $air, "first chunk has the data of the shared chunks");
+
+my ($data, @lens) = @{Games::Construder::World::get_sector_data (0, 0, 0)};
+is (length $data, length $air, "data of the sector is stored once");
+is ((scalar grep { $_ > 0 } @lens), 1, "one chunk carries the data");
+is ((scalar grep { $_ < 0 && $lens[-$_ - 1] <= 0 } @lens), 0,
+    "repeats refer to the chunk with the data");
+
+my $cnt = eval { Games::Construder::World::set_sector_data (1, 0, 0, $data, \@lens) };
+is ($cnt, scalar @lens, "all chunks imported") or diag $@;
+
+my $after = sector_data ([1, 0, 0]);
+ok ((!grep { $before->[$_] ne $after->[$_] } 0..$#$before), "imported sector matches");
@@ -18,16 +18,30 @@
 /* This file implements storage of the world. That means the chunks of the world
  * and information about the possible block types.
  *
- * The chunks of the world are currently saved in a set of nested sparse arrays.
+ * The chunks of the world are currently saved in a hash table keyed by the
+ * chunk coordinates, see ctr_chunk_dir in world_data_struct.c.
  */
 #include <stdio.h>
 #include <arpa/inet.h>
 #include "vectorlib.c"
 #include "queue.c"
+#include "slab.c"
 #include <assert.h>
 
-#define CHUNK_SIZE      12
-#define CHUNKS_P_SECTOR  5
+/* The size of the chunks is chosen at compile time. The default is 12,
+ * CTR_CHUNK_SHIFT selects a power of two size instead (4 => 16, 5 => 32),
+ * see Makefile.PL. With a power of two size the coordinate math is done
+ * with shifts and masks. The sector size should stay about the same,
+ * so the sector generation looks the same.
+ */
+#ifdef CTR_CHUNK_SHIFT
+# define CHUNK_SHIFT     CTR_CHUNK_SHIFT
+# define CHUNK_SIZE      (1 << CHUNK_SHIFT)
+# define CHUNKS_P_SECTOR (64 / CHUNK_SIZE)
+#else
+# define CHUNK_SIZE      12
+# define CHUNKS_P_SECTOR  5
+#endif
 #define MAX_LIGHT_RADIUS 18 // should be enough :)
 #define MAX_LIGHT_RADIUS_CHUNKS ( 6 * ((MAX_LIGHT_RADIUS + 1) * 2) * ((MAX_LIGHT_RADIUS + 1) * 2) * ((MAX_LIGHT_RADIUS + 1) * 2))
 // => 26^3 * 6 neighbors => ~1.3Mb ringbuffer for queue - should be enough :)
@@ -38,7 +52,20 @@
 #define MAX_MODEL_SIZE  (MAX_MODEL_DIM * MAX_MODEL_DIM * MAX_MODEL_DIM)
 
 #define myabs(x) ((x) < 0 ? -(x) : (x))
-#define REL_POS2OFFS(x,y,z) (myabs (x) + myabs (y) * CHUNK_SIZE + myabs (z) * (CHUNK_SIZE * CHUNK_SIZE))
+
+/* CHUNK_DIV rounds towards negative infinity, so it gives the chunk
+ * coordinate of an (integer) world coordinate, CHUNK_MOD the position
+ * inside that chunk.
+ */
+#ifdef CHUNK_SHIFT
+# define REL_POS2OFFS(x,y,z) (myabs (x) | (myabs (y) << CHUNK_SHIFT) | (myabs (z) << (CHUNK_SHIFT * 2)))
+# define CHUNK_DIV(v) ((v) >> CHUNK_SHIFT)
+# define CHUNK_MOD(v) ((v) & (CHUNK_SIZE - 1))
+#else
+# define REL_POS2OFFS(x,y,z) (myabs (x) + myabs (y) * CHUNK_SIZE + myabs (z) * (CHUNK_SIZE * CHUNK_SIZE))
+# define CHUNK_DIV(v) ((v) >= 0 ? (v) / CHUNK_SIZE : -((CHUNK_SIZE - 1 - (v)) / CHUNK_SIZE))
+# define CHUNK_MOD(v) ((v) - CHUNK_DIV (v) * CHUNK_SIZE)
+#endif
 
 #include "world_data_struct.c"
 
@@ -56,45 +83,203 @@ typedef struct _ctr_obj_attr {
   unsigned int   model_blocks[MAX_MODEL_SIZE];
 } ctr_obj_attr;
 
+/* The cells of a chunk are stored as planes, one array per field, so
+ * that scans which only need one field (eg. searching for block types or
+ * computing the visibility) only touch that field. Use the CELL_* macros
+ * below to access the cells of a chunk.
+ *
+ * Chunks with the same cells can share them, see ctr_chunk_share ().
+ * The visible bits depend on the neighbours of a chunk, and are
+ * stored in the chunk itself.
+ */
+#define CHUNK_VIS_LEN  ((CHUNK_ALEN + 7) / 8)
+#define CHUNK_DATA_LEN (CHUNK_ALEN * 4) // see ctr_world_get_chunk_data ()
+
+typedef struct _ctr_chunk_cells {
+   unsigned short type[CHUNK_ALEN];
+   unsigned char  light[CHUNK_ALEN];
+   unsigned char  meta[CHUNK_ALEN];
+   unsigned char  add[CHUNK_ALEN];  // lower nibble stores color of the block.
+
+   unsigned int refcnt;             // chunks using these cells, 0 if not shared
+   unsigned long long hash;         // of the chunk data, while shared
+   struct _ctr_chunk_cells *share_next;
+} ctr_chunk_cells;
+
+// The bytes of the cells that make up their content:
+#define CHUNK_CELLS_LEN (offsetof (ctr_chunk_cells, refcnt))
+
+#define CELL_TYPE(chnk,offs)  ((chnk)->cells->type[offs])
+#define CELL_LIGHT(chnk,offs) ((chnk)->cells->light[offs])
+#define CELL_META(chnk,offs)  ((chnk)->cells->meta[offs])
+#define CELL_ADD(chnk,offs)   ((chnk)->cells->add[offs])
+#define CELL_VISIBLE(chnk,offs) \
+  (((chnk)->visible[(offs) >> 3] >> ((offs) & 7)) & 1)
+#define CELL_SET_VISIBLE(chnk,offs,v) \
+  do { \
+    if (v) (chnk)->visible[(offs) >> 3] |=  (1 << ((offs) & 7)); \
+    else   (chnk)->visible[(offs) >> 3] &= ~(1 << ((offs) & 7)); \
+  } while (0)
+
+// A copy of a single cell, used where cells are (de)serialized one by one.
 typedef struct _ctr_cell {
    unsigned short type;
    unsigned char  light;
    unsigned char  meta;
-   unsigned char  add;  // lower nibble stores color of the block.
+   unsigned char  add;
+   unsigned char  visible;
+} ctr_cell;
 
-   // stores whether the block is visible (used by the renderer later).
-   unsigned char  visible : 1;
+/* The log of the last cell changes of a chunk. Every modifying access
+ * gives the chunk a new version and records the offset of the
+ * cell together with the new version. All changes after the version
+ * 'since' are in the log, if it runs full the older half is dropped
+ * and 'since' moves forward. Whoever knows an older version of the
+ * chunk has to fetch the whole chunk instead.
+ */
+#define CTR_CHUNK_CHANGES 128
 
-   unsigned char  pad     : 7; // some padding
-} ctr_cell;
+typedef struct _ctr_chunk_change {
+    unsigned long long version;
+    unsigned short     offs;
+} ctr_chunk_change;
 
-// Some (unfinished) try to implement storing changes:
-#if 0
-#define MAX_CHUNK_CHANGES 200
-typedef struct _ctr_chunk_changed_cell {
-    int rx, ry, rz;
-} ctr_chunk_changed_cell;
-#endif
+typedef struct _ctr_chunk_changes {
+    unsigned long long since;
+    unsigned int       len;
+    ctr_chunk_change   log[CTR_CHUNK_CHANGES];
+} ctr_chunk_changes;
+
+// Bytes per cell returned by ctr_chunk_get_changes ().
+#define CTR_CHUNK_CHANGE_LEN 6
+
+/* Directions of the neighbour chunks, the order matches the bits returned
+ * by ctr_world_set_chunk_from_data (). The opposite direction of d
+ * is CHUNK_OPPOSITE(d).
+ */
+#define CHUNK_LEFT  0 // -1,0,0
+#define CHUNK_BOT   1 // 0,-1,0
+#define CHUNK_FRONT 2 // 0,0,-1
+#define CHUNK_RIGHT 3 // 1,0,0
+#define CHUNK_TOP   4 // 0,1,0
+#define CHUNK_BACK  5 // 0,0,1
+#define CHUNK_OPPOSITE(d) (((d) + 3) % 6)
+
+static int ctr_chunk_neighbour_offs[6][3] = {
+  { -1,  0,  0 },
+  {  0, -1,  0 },
+  {  0,  0, -1 },
+  {  1,  0,  0 },
+  {  0,  1,  0 },
+  {  0,  0,  1 },
+};
+
+/* The packed representation of chunks that were not touched for a while.
+ * The block types are stored as bit packed indices into a palette of
+ * the types used in the chunk. Light is stored with 2 cells per byte,
+ * and the meta and add planes are left out completely if they are all 0.
+ *
+ * Everything lives in one allocation of 'size' bytes.
+ */
+typedef struct _ctr_chunk_packed {
+    unsigned int    size;
+    unsigned short  palette_len;
+    unsigned char   bits;    // bits per palette index: 0, 1, 2, 4, 8 or 16
+    unsigned short *palette;
+    unsigned char  *types;
+    unsigned char  *light;
+    unsigned char  *meta;    // 0 if all meta bytes are 0
+    unsigned char  *add;     // 0 if all add bytes are 0
+} ctr_chunk_packed;
 
 typedef struct _ctr_chunk {
     int x, y, z;
-    ctr_cell cells[CHUNK_ALEN];
+    ctr_chunk_cells *cells;   // 0 while the chunk is packed
+    ctr_chunk_packed *packed; // 0 while the chunk is unpacked
+    unsigned int touched;     // world tick of the last access
     int dirty;
-#if 0
-    ctr_chunk_changed_cell changed_cells[MAX_CHUNK_CHANGES];
-    int changes;
-#endif
+    int vis_stale;            // visible bits need a recompute, see ctr_chunk_visibility ()
+
+    // stores whether the block is visible (used by the renderer later).
+    unsigned char visible[CHUNK_VIS_LEN];
+    unsigned long long version;  // new one on every modification, see below
+    ctr_chunk_changes *changes;  // 0 until the first cell change
+
+    /* Offsets of the cells with a light source or an active type (in no
+     * particular order), see ctr_chunk_special (). Bulk writes only mark
+     * the index stale, it's rebuilt when it's needed next.
+     */
+    unsigned short *special;
+    unsigned short  special_len, special_size;
+
+    /* Summary of the cell types, see ctr_chunk_summary (). Kept up to date
+     * on single cell writes, bulk writes set summary_stale instead, and
+     * the summary and the index of special cells are rebuilt together.
+     * uniform is only cleared by single writes, so it might be 0 for a
+     * chunk whose cells happen to be all the same until the next rebuild.
+     */
+    unsigned int    nonair;          // cells with a type other than 0
+    unsigned int    opaque;          // cells with a non transparent type
+    unsigned int    face_opaque[6];  // opaque cells on the face in CHUNK_* direction
+    unsigned short  uniform_type;
+    unsigned char   uniform;         // all cells are of uniform_type
+    int             summary_stale;
+
+    /* Links to the loaded neighbour chunks (or 0), indexed by the
+     * CHUNK_* directions. Maintained by ctr_world_chunk () and
+     * ctr_world_purge_chunk ().
+     */
+    struct _ctr_chunk *neighbours[6];
 } ctr_chunk;
 
 typedef struct _ctr_world {
-    ctr_axis_array *y;
+    ctr_chunk_dir chunks;
+    unsigned int tick;          // advanced by ctr_world_tick ()
+
+    /* Last version handed out to a chunk. Versions are unique in the whole
+     * world, so a chunk that was purged and loaded again doesn't reuse
+     * the versions it had before. 0 is the version of new empty chunks.
+     */
+    unsigned long long version;
     SV *chunk_change_cb;        // callback for changed chunks.
     SV *active_cell_change_cb;  // callback for changed "active" cells.
+
+    /* The changes are collected here and passed to the callbacks in
+     * one call by ctr_world_flush_changes ().
+     */
+    AV *changed_chunks;         // x, y, z of each changed chunk
+    AV *changed_active_cells;   // x, y, z, type, data of each cell
 } ctr_world;
 
 static ctr_obj_attr OBJ_ATTR_MAP[POSSIBLE_OBJECTS];
 static ctr_world WORLD;
-static ctr_cell neighbour_cell;
+
+// Chunk headers and their cells are allocated from these, see slab.c.
+static ctr_slab ctr_chunk_slab;
+static ctr_slab ctr_chunk_cells_slab;
+static ctr_slab ctr_chunk_changes_slab;
+
+/* Transparency of every type, kept in sync with OBJ_ATTR_MAP, so the
+ * visibility pass can look it up without unpacking the bitfields.
+ */
+static unsigned char OBJ_TRANSPARENT[POSSIBLE_OBJECTS];
+
+/* The types that end up in the index of special cells of the chunks,
+ * light sources and active types. Chunks that exist when the types are
+ * set don't notice the change.
+ */
+#define CTR_SPECIAL_LIGHT  0x01
+#define CTR_SPECIAL_ACTIVE 0x02
+#define CTR_IS_LIGHT_TYPE(t) ((t) == 35 || (t) == 40 || (t) == 41)
+#define CTR_IS_SPECIAL_TYPE(t) ((t) >= 0 && (t) < POSSIBLE_OBJECTS && OBJ_SPECIAL[t])
+
+static unsigned char OBJ_SPECIAL[POSSIBLE_OBJECTS];
+
+/* Whether the visible bits of the cells are maintained at all. The
+ * server never renders and turns them off, see ctr_world_set_visibility ().
+ */
+static int ctr_world_visibility = 1;
+
 
 typedef struct _ctr_light_item {
     int x, y, z;
@@ -106,25 +291,21 @@ static ctr_queue *light_upd_queue   = 0;
 static ctr_queue *light_upd_queue_1 = 0;
 static ctr_queue *light_upd_queue_2 = 0;
 
-void ctr_world_chunk_buffer_init ();
-
 void ctr_world_init ()
 {
   int i;
-  WORLD.y = ctr_axis_array_new ();
+  ctr_chunk_dir_init (&WORLD.chunks);
+  ctr_slab_init (&ctr_chunk_slab, "chunk", sizeof (ctr_chunk));
+  ctr_slab_init (&ctr_chunk_cells_slab, "chunk cells", sizeof (ctr_chunk_cells));
+  ctr_slab_init (&ctr_chunk_changes_slab, "chunk change log",
+                 sizeof (ctr_chunk_changes));
   memset (OBJ_ATTR_MAP, 0, sizeof (OBJ_ATTR_MAP));
-  neighbour_cell.type    = 0;
-  neighbour_cell.light   = 0;
-  neighbour_cell.add     = 0;
-  neighbour_cell.meta    = 0;
-  neighbour_cell.visible = 1;
-  light_upd_queue_1 =
-     ctr_queue_new (sizeof (ctr_light_item),
-                    CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE * 9 * 2);
-  light_upd_queue_2 =
-     ctr_queue_new (sizeof (ctr_light_item),
-                    CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE * 9 * 2);
-  ctr_world_chunk_buffer_init ();
+  memset (OBJ_TRANSPARENT, 0, sizeof (OBJ_TRANSPARENT));
+  for (i = 0; i < POSSIBLE_OBJECTS; i++)
+    OBJ_SPECIAL[i] = CTR_IS_LIGHT_TYPE (i) ? CTR_SPECIAL_LIGHT : 0;
+  // the light queues grow with big light changes:
+  light_upd_queue_1 = ctr_queue_new (sizeof (ctr_light_item), CHUNK_ALEN);
+  light_upd_queue_2 = ctr_queue_new (sizeof (ctr_light_item), CHUNK_ALEN);
 }
 
 // Clears light queues for light computation.
@@ -191,47 +372,64 @@ int ctr_world_light_dequeue (int *x, int *y, int *z, unsigned char *light)
   return it != 0;
 }
 
+// Queues the chunk for the chunk change callback.
 void ctr_world_emit_chunk_change (int x, int y, int z)
 {
-  if (WORLD.chunk_change_cb)
-    {
-      dSP;
-      ENTER;
-      SAVETMPS;
-      PUSHMARK(SP);
-      XPUSHs(sv_2mortal(newSViv (x)));
-      XPUSHs(sv_2mortal(newSViv (y)));
-      XPUSHs(sv_2mortal(newSViv (z)));
-      PUTBACK;
-      call_sv (WORLD.chunk_change_cb, G_DISCARD | G_VOID);
-      ctr_prof_cnt.chunk_changes++;
-      SPAGAIN;
-      FREETMPS;
-      LEAVE;
-    }
+  if (!WORLD.chunk_change_cb)
+    return;
+
+  if (!WORLD.changed_chunks)
+    WORLD.changed_chunks = newAV ();
+  av_push (WORLD.changed_chunks, newSViv (x));
+  av_push (WORLD.changed_chunks, newSViv (y));
+  av_push (WORLD.changed_chunks, newSViv (z));
+  ctr_prof_cnt.chunk_changes++;
 }
 
-void ctr_world_emit_active_cell_change (int x, int y, int z, ctr_cell *c, SV *sv)
+// Queues the cell for the active cell change callback.
+void ctr_world_emit_active_cell_change (int x, int y, int z, unsigned int type, SV *sv)
 {
-  if (WORLD.active_cell_change_cb)
-    {
-      dSP;
-      ENTER;
-      SAVETMPS;
-      PUSHMARK(SP);
-      XPUSHs(sv_2mortal(newSViv (x)));
-      XPUSHs(sv_2mortal(newSViv (y)));
-      XPUSHs(sv_2mortal(newSViv (z)));
-      XPUSHs(sv_2mortal(newSViv (c->type)));
-      if (sv)
-        XPUSHs(sv);
-      PUTBACK;
-      call_sv (WORLD.active_cell_change_cb, G_DISCARD | G_VOID);
-      ctr_prof_cnt.active_cell_changes++;
-      SPAGAIN;
-      FREETMPS;
-      LEAVE;
-    }
+  if (!WORLD.active_cell_change_cb)
+    return;
+
+  if (!WORLD.changed_active_cells)
+    WORLD.changed_active_cells = newAV ();
+  av_push (WORLD.changed_active_cells, newSViv (x));
+  av_push (WORLD.changed_active_cells, newSViv (y));
+  av_push (WORLD.changed_active_cells, newSViv (z));
+  av_push (WORLD.changed_active_cells, newSViv (type));
+  av_push (WORLD.changed_active_cells, sv ? newSVsv (sv) : newSV (0));
+  ctr_prof_cnt.active_cell_changes++;
+}
+
+static void ctr_world_call_batch (SV *cb, AV **batch)
+{
+  AV *av = *batch;
+  if (!av)
+    return;
+  *batch = 0; // the callback might cause new changes
+
+  dSP;
+  ENTER;
+  SAVETMPS;
+  PUSHMARK(SP);
+  XPUSHs(sv_2mortal(newRV_noinc ((SV *) av)));
+  PUTBACK;
+  call_sv (cb, G_DISCARD | G_VOID);
+  SPAGAIN;
+  FREETMPS;
+  LEAVE;
+}
+
+/* Calls the change callbacks, each once with an array of all changes
+ * that were queued since the last flush. Happens at the end of
+ * ctr_world_query_desetup (), for changes outside of queries call this
+ * yourself.
+ */
+void ctr_world_flush_changes ()
+{
+  ctr_world_call_batch (WORLD.active_cell_change_cb, &WORLD.changed_active_cells);
+  ctr_world_call_batch (WORLD.chunk_change_cb, &WORLD.changed_chunks);
 }
 
 ctr_obj_attr *ctr_world_get_attr (unsigned int type)
@@ -255,9 +453,13 @@ void ctr_world_set_object_type (
 {
   ctr_obj_attr *oa = ctr_world_get_attr (type);
   oa->transparent = transparent;
+  OBJ_TRANSPARENT[type] = transparent ? 1 : 0;
   oa->blocking    = blocking;
   oa->has_txt     = has_txt;
   oa->active      = active;
+  OBJ_SPECIAL[type] =
+    (CTR_IS_LIGHT_TYPE (type) ? CTR_SPECIAL_LIGHT : 0)
+    | (active ? CTR_SPECIAL_ACTIVE : 0);
   oa->uv[0]       = uv0;
   oa->uv[1]       = uv1;
   oa->uv[2]       = uv2;
@@ -284,30 +486,6 @@ void ctr_world_set_object_model (unsigned int type, unsigned int dim, AV *blocks
     }
 }
 
-int ctr_set_cell_from_data (ctr_cell *c, unsigned char *ptr)
-{
- //d//printf ("CELL dATA %p: %02x %02x %02x %02x\n", c, *ptr, *(ptr + 1), *(ptr + 2), *(ptr + 3));
-  unsigned short *sptr = (short *) ptr;
-  unsigned short blk = ntohs (*sptr);
-  unsigned short type  = ((blk & 0xFFF0) >> 4);
-  unsigned short light = blk & 0x000F;
-  sptr++;
-  ptr = (unsigned char *) sptr;
-  unsigned char  meta  = *ptr;
-  ptr++;
-  unsigned char  add   = *ptr;
-
-  int chg = 0;
-  if (c->type != type)   chg = 1;
-  if (c->light != light) chg = 1;
-
-  c->type  = type;
-  c->light = light;
-  c->meta  = meta;
-  c->add   = add;
-  return chg;
-}
-
 void ctr_get_data_from_cell (ctr_cell *c, unsigned char *ptr)
 {
   unsigned char *optr = ptr;
@@ -323,315 +501,1334 @@ void ctr_get_data_from_cell (ctr_cell *c, unsigned char *ptr)
  //d//printf ("CELL GET DATA %p: %02x %02x %02x %02x\n", c, *optr, *(optr + 1), *(optr + 2), *(optr + 3));
 }
 
-void ctr_chunk_clear_changes (ctr_chunk *chnk)
+/* The shared cells of the chunks, in a hash table by the hash of their
+ * chunk data and chained by share_next. Shared cells are never written,
+ * a chunk gets its own copy before it changes them, see ctr_chunk_unshare ().
+ */
+static ctr_chunk_cells **ctr_chunk_shared;
+static unsigned int      ctr_chunk_shared_len, ctr_chunk_shared_mask;
+
+// A fast 64 bit hash of len bytes at data.
+unsigned long long ctr_hash_bytes (const unsigned char *data, unsigned int len)
 {
-#if 0
-  chnk->changes = 0;
-#endif
+  unsigned long long h = 0x9E3779B97F4A7C15ULL ^ len, w;
+  unsigned int i;
+  for (i = 0; i + 8 <= len; i += 8)
+    {
+      memcpy (&w, data + i, 8);
+      h ^= w * 0xBF58476D1CE4E5B9ULL;
+      h  = ((h << 31) | (h >> 33)) * 0x94D049BB133111EBULL;
+    }
+  for (; i < len; i++)
+    h = (h ^ data[i]) * 0x100000001B3ULL;
+
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  return h ^ (h >> 32);
 }
 
-#if 0
-void ctr_chunk_cell_changed (ctr_chunk *chnk, unsigned int x, unsigned int y, unsigned int z) 
+#define ctr_chunk_data_hash(data) ctr_hash_bytes ((data), CHUNK_DATA_LEN)
+
+static void ctr_chunk_shared_insert (ctr_chunk_cells *cells)
 {
-  if (chnk->changes < MAX_CHUNK_CHANGES)
+  if (ctr_chunk_shared_len >= ctr_chunk_shared_mask)
     {
-      ctr_chunk_changed_cell *cc = &(chnk->changed_cells[chnk->changes++]);
-      cc->rx = x;
-      cc->ry = y;
-      cc->rz = z;
+      unsigned int old_size = ctr_chunk_shared ? ctr_chunk_shared_mask + 1 : 0,
+                   size     = old_size ? old_size * 2 : 256,
+                   i;
+      ctr_chunk_cells **buckets = safemalloc (sizeof (ctr_chunk_cells *) * size);
+      memset (buckets, 0, sizeof (ctr_chunk_cells *) * size);
+
+      for (i = 0; i < old_size; i++)
+        while (ctr_chunk_shared[i])
+          {
+            ctr_chunk_cells *c = ctr_chunk_shared[i];
+            ctr_chunk_shared[i] = c->share_next;
+            c->share_next = buckets[c->hash & (size - 1)];
+            buckets[c->hash & (size - 1)] = c;
+          }
+
+      if (ctr_chunk_shared)
+        safefree (ctr_chunk_shared);
+      ctr_chunk_shared      = buckets;
+      ctr_chunk_shared_mask = size - 1;
     }
 
-  chnk->dirty = 1;
+  ctr_chunk_cells **b = &(ctr_chunk_shared[cells->hash & ctr_chunk_shared_mask]);
+  cells->share_next = *b;
+  *b = cells;
+  ctr_chunk_shared_len++;
 }
-#endif
 
-ctr_cell *ctr_chunk_cell_at_rel (ctr_chunk *chnk, unsigned int x, unsigned int y, unsigned int z)
+static void ctr_chunk_shared_remove (ctr_chunk_cells *cells)
 {
-  unsigned int offs = REL_POS2OFFS (x, y, z);
-  return &(chnk->cells[offs]);
+  ctr_chunk_cells **b = &(ctr_chunk_shared[cells->hash & ctr_chunk_shared_mask]);
+  while (*b != cells)
+    b = &((*b)->share_next);
+  *b = cells->share_next;
+  cells->share_next = 0;
+  ctr_chunk_shared_len--;
 }
 
-ctr_cell *ctr_chunk_cell_at_abs (ctr_chunk *chnk, double x, double y, double z)
+/* Lets the (unpacked) chunk share its cells with the other chunks that
+ * have the same cells. hash is the hash of the chunk's data, see
+ * ctr_chunk_data_hash (). Returns true if the cells are shared with
+ * another chunk now.
+ */
+int ctr_chunk_share (ctr_chunk *chnk, unsigned long long hash)
 {
-  vec3_init (pos, x, y, z);
-  vec3_s_div (pos, CHUNK_SIZE);
-  vec3_floor (pos);
-  x -= pos[0] * CHUNK_SIZE;
-  y -= pos[1] * CHUNK_SIZE;
-  z -= pos[2] * CHUNK_SIZE;
-  x = floor (x);
-  y = floor (y);
-  z = floor (z);
-  int xi = x, yi = y, zi = z;
-  unsigned int offs = REL_POS2OFFS (xi, yi, zi);
-  return &(chnk->cells[offs]);
+  ctr_chunk_cells *cells = chnk->cells;
+  if (cells->refcnt)
+    return cells->refcnt > 1;
+
+  if (ctr_chunk_shared)
+    {
+      ctr_chunk_cells *c = ctr_chunk_shared[hash & ctr_chunk_shared_mask];
+      for (; c; c = c->share_next)
+        if (c->hash == hash && !memcmp (c, cells, CHUNK_CELLS_LEN))
+          {
+            ctr_slab_free (&ctr_chunk_cells_slab, cells);
+            chnk->cells = c;
+            c->refcnt++;
+            ctr_prof_cnt.shared_chunks++;
+            return 1;
+          }
+    }
+
+  cells->refcnt = 1;
+  cells->hash   = hash;
+  ctr_chunk_shared_insert (cells);
+  return 0;
 }
 
-int ctr_world_cell_transparent (ctr_cell *c)
+// Gives the chunk its own copy of its cells, if they are shared.
+void ctr_chunk_unshare (ctr_chunk *chnk)
 {
-  ctr_obj_attr *oa = ctr_world_get_attr (c->type);
-  return oa->transparent;
+  ctr_chunk_cells *cells = chnk->cells;
+  if (!cells || !cells->refcnt)
+    return;
+
+  if (cells->refcnt == 1)
+    {
+      ctr_chunk_shared_remove (cells);
+      cells->refcnt = 0;
+      return;
+    }
+
+  ctr_chunk_cells *own = ctr_slab_alloc (&ctr_chunk_cells_slab);
+  memcpy (own, cells, CHUNK_CELLS_LEN);
+  own->refcnt     = 0;
+  own->share_next = 0;
+  chnk->cells = own;
+  cells->refcnt--;
+  ctr_prof_cnt.shared_chunks--;
 }
 
+// Drops a chunk's reference to its cells, they are freed by the last one.
+void ctr_chunk_cells_release (ctr_chunk_cells *cells)
+{
+  if (cells->refcnt > 1)
+    {
+      cells->refcnt--;
+      ctr_prof_cnt.shared_chunks--;
+      return;
+    }
+
+  if (cells->refcnt == 1)
+    ctr_chunk_shared_remove (cells);
+  ctr_slab_free (&ctr_chunk_cells_slab, cells);
+}
 
-ctr_cell *
-ctr_world_chunk_neighbour_cell (ctr_chunk *c, int x, int y, int z, ctr_chunk *neigh_chunk)
+static void ctr_chunk_special_add (ctr_chunk *chnk, unsigned int offs)
 {
-  if (   x < 0 || y < 0 || z < 0
-      || x >= CHUNK_SIZE || y >= CHUNK_SIZE || z >= CHUNK_SIZE)
+  if (chnk->special_len == chnk->special_size)
     {
-      if (neigh_chunk)
-        {
-          if (x < 0) x += CHUNK_SIZE;
-          if (y < 0) y += CHUNK_SIZE;
-          if (z < 0) z += CHUNK_SIZE;
-          if (x >= CHUNK_SIZE) x -= CHUNK_SIZE;
-          if (y >= CHUNK_SIZE) y -= CHUNK_SIZE;
-          if (z >= CHUNK_SIZE) z -= CHUNK_SIZE;
-          c = neigh_chunk;
-        }
-      else
-        return &neighbour_cell;
+      chnk->special_size = chnk->special_size ? chnk->special_size * 2 : 8;
+      chnk->special =
+        saferealloc (chnk->special, sizeof (unsigned short) * chnk->special_size);
     }
+  chnk->special[chnk->special_len++] = offs;
+}
 
-  unsigned int offs = REL_POS2OFFS(x, y, z);
+static void ctr_chunk_special_remove (ctr_chunk *chnk, unsigned int offs)
+{
+  unsigned int i;
+  for (i = 0; i < chnk->special_len; i++)
+    if (chnk->special[i] == offs)
+      {
+        chnk->special[i] = chnk->special[--chnk->special_len];
+        return;
+      }
+}
+
+#define CHUNK_FACE_ALEN (CHUNK_SIZE * CHUNK_SIZE)
 
-  return &(c->cells[offs]);
+// Adds d to the opaque cell counts of the faces the cell at x, y, z is on.
+static void ctr_chunk_summary_faces (ctr_chunk *chnk, int x, int y, int z, int d)
+{
+  if (x == 0)              chnk->face_opaque[CHUNK_LEFT]  += d;
+  if (x == CHUNK_SIZE - 1) chnk->face_opaque[CHUNK_RIGHT] += d;
+  if (y == 0)              chnk->face_opaque[CHUNK_BOT]   += d;
+  if (y == CHUNK_SIZE - 1) chnk->face_opaque[CHUNK_TOP]   += d;
+  if (z == 0)              chnk->face_opaque[CHUNK_FRONT] += d;
+  if (z == CHUNK_SIZE - 1) chnk->face_opaque[CHUNK_BACK]  += d;
 }
 
-#define LOAD_NEIGHBOUR_CHUNKS(x,y,z) \
-  ctr_chunk *top_chunk = ctr_world_chunk (x, y + 1, z, 0); \
-  ctr_chunk *bot_chunk = ctr_world_chunk (x, y - 1, z, 0); \
-  ctr_chunk *left_chunk = ctr_world_chunk (x - 1, y, z, 0); \
-  ctr_chunk *right_chunk = ctr_world_chunk (x + 1, y, z, 0); \
-  ctr_chunk *front_chunk = ctr_world_chunk (x, y, z - 1, 0); \
-  ctr_chunk *back_chunk = ctr_world_chunk (x, y, z + 1, 0);
+/* Rebuilds the summary of the cell types and the index of special cells
+ * from the type plane (of an unpacked chunk), in one pass.
+ */
+void ctr_chunk_summarize (ctr_chunk *chnk)
+{
+  unsigned short *type = chnk->cells->type;
+  unsigned short first = type[0];
+  unsigned int nonair = 0, opaque = 0, uniform = 1;
+  unsigned int i, a, b;
+
+  chnk->special_len   = 0;
+  chnk->summary_stale = 0;
+  for (i = 0; i < CHUNK_ALEN; i++)
+    {
+      unsigned short t = type[i];
+      nonair  += t != 0;
+      opaque  += !OBJ_TRANSPARENT[t];
+      uniform &= t == first;
+      if (OBJ_SPECIAL[t])
+        ctr_chunk_special_add (chnk, i);
+    }
 
-#define GET_NEIGHBOURS(c, x,y,z) \
-  ctr_cell *top   = ctr_world_chunk_neighbour_cell (c, x, y + 1, z, top_chunk); \
-  ctr_cell *bot   = ctr_world_chunk_neighbour_cell (c, x, y - 1, z, bot_chunk); \
-  ctr_cell *left  = ctr_world_chunk_neighbour_cell (c, x - 1, y, z, left_chunk); \
-  ctr_cell *right = ctr_world_chunk_neighbour_cell (c, x + 1, y, z, right_chunk); \
-  ctr_cell *front = ctr_world_chunk_neighbour_cell (c, x, y, z - 1, front_chunk); \
-  ctr_cell *back  = ctr_world_chunk_neighbour_cell (c, x, y, z + 1, back_chunk);
+  memset (chnk->face_opaque, 0, sizeof (chnk->face_opaque));
+  for (a = 0; a < CHUNK_SIZE; a++)
+    for (b = 0; b < CHUNK_SIZE; b++)
+      {
+        chnk->face_opaque[CHUNK_LEFT]  += !OBJ_TRANSPARENT[type[REL_POS2OFFS (0, a, b)]];
+        chnk->face_opaque[CHUNK_RIGHT] += !OBJ_TRANSPARENT[type[REL_POS2OFFS (CHUNK_SIZE - 1, a, b)]];
+        chnk->face_opaque[CHUNK_BOT]   += !OBJ_TRANSPARENT[type[REL_POS2OFFS (a, 0, b)]];
+        chnk->face_opaque[CHUNK_TOP]   += !OBJ_TRANSPARENT[type[REL_POS2OFFS (a, CHUNK_SIZE - 1, b)]];
+        chnk->face_opaque[CHUNK_FRONT] += !OBJ_TRANSPARENT[type[REL_POS2OFFS (a, b, 0)]];
+        chnk->face_opaque[CHUNK_BACK]  += !OBJ_TRANSPARENT[type[REL_POS2OFFS (a, b, CHUNK_SIZE - 1)]];
+      }
+
+  chnk->nonair       = nonair;
+  chnk->opaque       = opaque;
+  chnk->uniform      = uniform;
+  chnk->uniform_type = first;
+}
 
+#define CTR_ALL_FACES 0x3F
 
-#define GET_LOCAL_NEIGHBOURS(c, x,y,z) \
-  ctr_cell *top   = ctr_world_chunk_neighbour_cell (c, x, y + 1, z, 0); \
-  ctr_cell *bot   = ctr_world_chunk_neighbour_cell (c, x, y - 1, z, 0); \
-  ctr_cell *left  = ctr_world_chunk_neighbour_cell (c, x - 1, y, z, 0); \
-  ctr_cell *right = ctr_world_chunk_neighbour_cell (c, x + 1, y, z, 0); \
-  ctr_cell *front = ctr_world_chunk_neighbour_cell (c, x, y, z - 1, 0); \
-  ctr_cell *back  = ctr_world_chunk_neighbour_cell (c, x, y, z + 1, 0);
+/* Marks the visibility of the chunk stale, and of the neighbours on the
+ * given faces (bit d for the CHUNK_* direction d), whose border cells
+ * might be covered or uncovered now.
+ */
+void ctr_chunk_visibility_changed (ctr_chunk *chnk, unsigned int faces)
+{
+  int d;
+  chnk->vis_stale = 1;
+  for (d = 0; d < 6; d++)
+    if ((faces & (1 << d)) && chnk->neighbours[d])
+      chnk->neighbours[d]->vis_stale = 1;
+}
 
-/* Calculate the visibility of the blocks. If a block is surrounded by
- * 6 non transparent blocks it's considered non visible.
+/* Keeps the summary, the index of special cells and the visibility up
+ * to date when a single cell changes its type.
  */
-void ctr_world_chunk_calc_visibility (ctr_chunk *chnk)
+void ctr_chunk_type_changed (ctr_chunk *chnk, unsigned int offs, unsigned int old_type, unsigned int new_type)
 {
-  int x, y, z;
-  for (z = 0; z < CHUNK_SIZE; z++)
-    for (y = 0; y < CHUNK_SIZE; y++)
-      for (x = 0; x < CHUNK_SIZE; x++)
-        {
-          unsigned int offs = REL_POS2OFFS (x, y, z);
-          chnk->cells[offs].visible = 0;
-        }
+  if (old_type == new_type)
+    return;
 
-  int cnt, cnt2;
-  for (z = 0; z < CHUNK_SIZE; z++)
-    for (y = 0; y < CHUNK_SIZE; y++)
-      for (x = 0; x < CHUNK_SIZE; x++)
-        {
-          ctr_cell *cell = &(chnk->cells[REL_POS2OFFS(x,y,z)]);
-          if (cell->type == 0)
-            continue;
-
-          // afraid of slowness to not use GET_NEIGHBOURS...
-          GET_LOCAL_NEIGHBOURS(chnk, x, y, z);
-          if (ctr_world_cell_transparent (top))
-            { cell->visible = 1; continue; }
-          if (ctr_world_cell_transparent (bot))
-            { cell->visible = 1; continue; }
-          if (ctr_world_cell_transparent (left))
-            { cell->visible = 1; continue; }
-          if (ctr_world_cell_transparent (right))
-            { cell->visible = 1; continue; }
-          if (ctr_world_cell_transparent (front))
-            { cell->visible = 1; continue; }
-          if (ctr_world_cell_transparent (back))
-            { cell->visible = 1; continue; }
-        }
+  int x = offs % CHUNK_SIZE,
+      y = (offs / CHUNK_SIZE) % CHUNK_SIZE,
+      z = offs / (CHUNK_SIZE * CHUNK_SIZE);
+
+  ctr_chunk_visibility_changed (chnk,
+      (x == 0)              << CHUNK_LEFT
+    | (x == CHUNK_SIZE - 1) << CHUNK_RIGHT
+    | (y == 0)              << CHUNK_BOT
+    | (y == CHUNK_SIZE - 1) << CHUNK_TOP
+    | (z == 0)              << CHUNK_FRONT
+    | (z == CHUNK_SIZE - 1) << CHUNK_BACK);
+
+  if (chnk->summary_stale)
+    return;
+
+  chnk->nonair += (new_type != 0) - (old_type != 0);
+  if (chnk->uniform && new_type != chnk->uniform_type)
+    chnk->uniform = 0;
+
+  int d = OBJ_TRANSPARENT[old_type] - OBJ_TRANSPARENT[new_type];
+  if (d)
+    {
+      chnk->opaque += d;
+      ctr_chunk_summary_faces (chnk, x, y, z, d);
+    }
+
+  if (!OBJ_SPECIAL[old_type] == !OBJ_SPECIAL[new_type])
+    return;
+
+  if (OBJ_SPECIAL[new_type])
+    ctr_chunk_special_add (chnk, offs);
+  else
+    ctr_chunk_special_remove (chnk, offs);
+}
+
+/* Gives the chunk its own cells, marks it dirty and records the change
+ * of the cell at offs.
+ */
+void ctr_chunk_cell_changed (ctr_chunk *chnk, unsigned int offs)
+{
+  ctr_chunk_unshare (chnk);
+  unsigned long long prev = chnk->version;
+  chnk->dirty   = 1;
+  chnk->version = ++WORLD.version;
+
+  ctr_chunk_changes *chg = chnk->changes;
+  if (!chg)
+    {
+      // without a log (over the memory budget) only whole chunks can be fetched.
+      chg = chnk->changes = ctr_slab_try_alloc (&ctr_chunk_changes_slab);
+      if (!chg)
+        return;
+      chg->since = prev;
+      chg->len   = 0;
+    }
+
+  // the same cell is often accessed a few times in a row:
+  if (chg->len > 0 && chg->log[chg->len - 1].offs == offs)
+    {
+      chg->log[chg->len - 1].version = chnk->version;
+      return;
+    }
+
+  if (chg->len == CTR_CHUNK_CHANGES)
+    {
+      unsigned int drop = CTR_CHUNK_CHANGES / 2;
+      chg->since = chg->log[drop - 1].version;
+      memmove (chg->log, chg->log + drop,
+               (chg->len - drop) * sizeof (ctr_chunk_change));
+      chg->len -= drop;
+    }
+
+  ctr_chunk_change *c = &(chg->log[chg->len++]);
+  c->version = chnk->version;
+  c->offs    = offs;
+}
+
+// Records that all cells of the chunk changed.
+void ctr_chunk_all_changed (ctr_chunk *chnk)
+{
+  chnk->version = ++WORLD.version;
+  if (chnk->changes)
+    {
+      chnk->changes->since = chnk->version;
+      chnk->changes->len   = 0;
+    }
+}
+
+/* Records the cells of the (unpacked and unshared) chunk whose light
+ * differs from old, the light before a bulk write. More changes than the
+ * log holds count as a change of the whole chunk. The summary and the
+ * visibility don't depend on the light, they stay as they are.
+ */
+void ctr_chunk_light_changed (ctr_chunk *chnk, unsigned char *old)
+{
+  unsigned int i, cnt = 0;
+  for (i = 0; i < CHUNK_ALEN; i++)
+    cnt += CELL_LIGHT (chnk, i) != old[i];
+  if (cnt == 0)
+    return;
+
+  if (cnt > CTR_CHUNK_CHANGES)
+    {
+      ctr_chunk_all_changed (chnk);
+      chnk->dirty = 1;
+      return;
+    }
+
+  for (i = 0; i < CHUNK_ALEN; i++)
+    if (CELL_LIGHT (chnk, i) != old[i])
+      ctr_chunk_cell_changed (chnk, i);
+}
+
+// Copies the cell at offs of the (unpacked) chunk to c.
+void ctr_chunk_get_cell (ctr_chunk *chnk, unsigned int offs, ctr_cell *c)
+{
+  c->type    = CELL_TYPE (chnk, offs);
+  c->light   = CELL_LIGHT (chnk, offs);
+  c->meta    = CELL_META (chnk, offs);
+  c->add     = CELL_ADD (chnk, offs);
+  c->visible = CELL_VISIBLE (chnk, offs);
+}
+
+// Returns the offset of the cell at the absolute world coordinates.
+unsigned int ctr_chunk_offs_at_abs (double x, double y, double z)
+{
+  int xi = floor (x), yi = floor (y), zi = floor (z);
+  xi = CHUNK_MOD (xi);
+  yi = CHUNK_MOD (yi);
+  zi = CHUNK_MOD (zi);
+  return REL_POS2OFFS (xi, yi, zi);
+}
+
+int ctr_world_cell_transparent (ctr_chunk *chnk, unsigned int offs)
+{
+  return OBJ_TRANSPARENT[CELL_TYPE (chnk, offs)];
+}
+
+/* The chunk data (for the network and the sector files) has 4 bytes per
+ * cell in the order of the cell offsets: the type (12 bits) and the
+ * light (4 bits) as big endian short, then meta and add.
+ *
+ * The two functions below convert between that and the cell planes
+ * with loops over whole planes, that the compiler turns into SIMD code
+ * working on 16 cells at a time. See scripts/benchmark codec.
+ */
+
+// restrict tells the compiler that the planes and the data don't overlap.
+static void ctr_chunk_decode (const unsigned char *restrict src,
+                              unsigned short *restrict types,
+                              unsigned char  *restrict lights,
+                              unsigned char  *restrict metas,
+                              unsigned char  *restrict adds,
+                              unsigned char  *restrict chg)
+{
+  unsigned int i;
+  for (i = 0; i < CHUNK_ALEN; i++)
+    {
+      const unsigned char *d = src + i * 4;
+      unsigned short type  = (d[0] << 4) | (d[1] >> 4);
+      unsigned char  light = d[1] & 0x0F;
+      chg[i] = (types[i] != type) | (lights[i] != light);
+      types[i]  = type;
+      lights[i] = light;
+      metas[i]  = d[2];
+      adds[i]   = d[3];
+    }
 }
 
+static void ctr_chunk_encode (unsigned char *restrict dst,
+                              const unsigned short *restrict types,
+                              const unsigned char  *restrict lights,
+                              const unsigned char  *restrict metas,
+                              const unsigned char  *restrict adds)
+{
+  unsigned int i;
+  for (i = 0; i < CHUNK_ALEN; i++)
+    {
+      unsigned char *d = dst + i * 4;
+      unsigned short type = types[i];
+      d[0] = type >> 4;
+      d[1] = (type << 4) | (lights[i] & 0x0F);
+      d[2] = metas[i];
+      d[3] = adds[i];
+    }
+}
+
+/* Sets the cells of the (unpacked) chunk from data. Returns the
+ * CHUNK_* direction bits (1 << dir) of the neighbour chunks that touch
+ * changed cells.
+ */
 int ctr_world_set_chunk_from_data (ctr_chunk *chnk, unsigned char *data, unsigned int len)
 {
-  unsigned int x, y, z;
-  int neigh_chunks = 0;
+  static unsigned char chg[CHUNK_ALEN];
+  ctr_chunk_unshare (chnk);
+  ctr_chunk_cells *cells = chnk->cells;
+
+  assert (len >= CHUNK_ALEN * 4);
 
+  CTR_PROF_BEGIN (t_start);
+  ctr_chunk_decode (data, cells->type, cells->light, cells->meta, cells->add, chg);
+  ctr_chunk_summarize (chnk);
+
+  int neigh_chunks = 0;
+  unsigned int x, y, z;
   for (z = 0; z < CHUNK_SIZE; z++)
     for (y = 0; y < CHUNK_SIZE; y++)
-      for (x = 0; x < CHUNK_SIZE; x++)
-        {
-          unsigned int offs = REL_POS2OFFS (x, y, z);
-          assert (len > (offs * 4) + 3);
-          int chg = ctr_set_cell_from_data (&(chnk->cells[offs]), data + (offs * 4));
-          if (chg)
-            {
-              if (x == 0)
-                neigh_chunks |= 0x01; // -1,0,0
-              if (y == 0)
-                neigh_chunks |= 0x02; // 0,-1,0
-              if (z == 0)
-                neigh_chunks |= 0x04; // 0,0,-1
-              if (x == (CHUNK_SIZE - 1)) // 1,0,0
-                neigh_chunks |= 0x08;
-              if (y == (CHUNK_SIZE - 1)) // 0,1,0
-                neigh_chunks |= 0x10;
-              if (z == (CHUNK_SIZE - 1)) // 0,0,1
-                neigh_chunks |= 0x20;
-            }
-        }
+      {
+        unsigned char *row = &(chg[REL_POS2OFFS (0, y, z)]);
+        unsigned char any = 0;
+        for (x = 0; x < CHUNK_SIZE; x++)
+          any |= row[x];
+        if (!any)
+          continue;
+
+        if (row[0])
+          neigh_chunks |= 0x01; // -1,0,0
+        if (y == 0)
+          neigh_chunks |= 0x02; // 0,-1,0
+        if (z == 0)
+          neigh_chunks |= 0x04; // 0,0,-1
+        if (row[CHUNK_SIZE - 1]) // 1,0,0
+          neigh_chunks |= 0x08;
+        if (y == (CHUNK_SIZE - 1)) // 0,1,0
+          neigh_chunks |= 0x10;
+        if (z == (CHUNK_SIZE - 1)) // 0,0,1
+          neigh_chunks |= 0x20;
+      }
+
+  ctr_chunk_all_changed (chnk);
+  ctr_chunk_visibility_changed (chnk, neigh_chunks);
+  CTR_PROF_END (CTR_PROF_DECODE, t_start);
 
   return neigh_chunks;
 }
 
+// Stores the cells of the (unpacked) chunk in data, CHUNK_ALEN * 4 bytes.
 void ctr_world_get_chunk_data (ctr_chunk *chnk, unsigned char *data)
 {
-  unsigned int x, y, z;
-  for (z = 0; z < CHUNK_SIZE; z++)
-    for (y = 0; y < CHUNK_SIZE; y++)
-      for (x = 0; x < CHUNK_SIZE; x++)
+  ctr_chunk_cells *cells = chnk->cells;
+  ctr_chunk_encode (data, cells->type, cells->light, cells->meta, cells->add);
+}
+
+/* Packs the chunk, returns 0 if the chunk can't be packed (it's already
+ * packed, shares its cells or stores light values that don't fit 4 bits).
+ */
+int ctr_chunk_pack (ctr_chunk *chnk)
+{
+  static unsigned short type_idx[POSSIBLE_OBJECTS];
+  unsigned short palette[POSSIBLE_OBJECTS];
+  unsigned int palette_len = 0;
+  int has_meta = 0, has_add = 0;
+  unsigned int i;
+
+  // shared cells already cost less than packed ones:
+  if (chnk->packed || chnk->cells->refcnt > 1)
+    return 0;
+
+  ctr_chunk_cells *cells = chnk->cells;
+  for (i = 0; i < CHUNK_ALEN; i++)
+    {
+      if (cells->light[i] > 15)
         {
-          unsigned int offs = REL_POS2OFFS (x, y, z);
-          ctr_get_data_from_cell (&(chnk->cells[offs]), data + (offs * 4));
+          for (i = 0; i < palette_len; i++)
+            type_idx[palette[i]] = 0;
+          return 0;
         }
+
+      if (cells->meta[i]) has_meta = 1;
+      if (cells->add[i])  has_add  = 1;
+
+      // type_idx stores the palette index + 1, 0 means: not in the palette yet
+      if (!type_idx[cells->type[i]])
+        {
+          palette[palette_len++] = cells->type[i];
+          type_idx[cells->type[i]] = palette_len;
+        }
+    }
+
+  unsigned int bits = 16;
+  if      (palette_len == 1)   bits = 0;
+  else if (palette_len <= 2)   bits = 1;
+  else if (palette_len <= 4)   bits = 2;
+  else if (palette_len <= 16)  bits = 4;
+  else if (palette_len <= 256) bits = 8;
+
+  unsigned int palette_size = sizeof (unsigned short) * palette_len,
+               types_size   = (CHUNK_ALEN * bits + 7) / 8,
+               light_size   = (CHUNK_ALEN + 1) / 2,
+               plane_size   = CHUNK_ALEN;
+  palette_size = (palette_size + 1) & ~1; // keep 16 bit indices aligned
+
+  unsigned int size =
+    sizeof (ctr_chunk_packed) + palette_size + types_size + light_size
+    + (has_meta ? plane_size : 0) + (has_add ? plane_size : 0);
+
+  ctr_chunk_packed *p = safemalloc (size);
+  unsigned char *ptr = (unsigned char *) (p + 1);
+  memset (ptr, 0, size - sizeof (ctr_chunk_packed));
+
+  p->size        = size;
+  p->palette_len = palette_len;
+  p->bits        = bits;
+  p->palette     = (unsigned short *) ptr; ptr += palette_size;
+  p->types       = ptr;                    ptr += types_size;
+  p->light       = ptr;                    ptr += light_size;
+  p->meta        = has_meta ? ptr : 0;     ptr += has_meta ? plane_size : 0;
+  p->add         = has_add  ? ptr : 0;
+
+  memcpy (p->palette, palette, sizeof (unsigned short) * palette_len);
+
+  for (i = 0; i < CHUNK_ALEN; i++)
+    {
+      unsigned int idx = type_idx[cells->type[i]] - 1;
+
+      if (bits == 16)
+        ((unsigned short *) p->types)[i] = idx;
+      else if (bits > 0)
+        p->types[(i * bits) >> 3] |= idx << ((i * bits) & 7);
+
+      p->light[i >> 1] |= cells->light[i] << ((i & 1) * 4);
+    }
+
+  if (has_meta) memcpy (p->meta, cells->meta, plane_size);
+  if (has_add)  memcpy (p->add,  cells->add,  plane_size);
+
+  for (i = 0; i < palette_len; i++)
+    type_idx[palette[i]] = 0;
+
+  ctr_chunk_cells_release (chnk->cells);
+  chnk->cells  = 0;
+  chnk->packed = p;
+
+  ctr_prof_cnt.packed_chunks++;
+  ctr_prof_cnt.packed_chunks_size += size;
+  return 1;
 }
 
-#define CTR_BUF_CHUNKS 2000
-static ctr_chunk *ctr_buffered_chunks_buf[CTR_BUF_CHUNKS];
-static int ctr_buffered_chunks = 0;
+// Decodes one cell of a packed chunk.
+void ctr_chunk_packed_cell (ctr_chunk *chnk, unsigned int offs, ctr_cell *c)
+{
+  ctr_chunk_packed *p = chnk->packed;
+  unsigned int idx = 0;
+  if (p->bits == 16)
+    idx = ((unsigned short *) p->types)[offs];
+  else if (p->bits > 0)
+    idx = (p->types[(offs * p->bits) >> 3] >> ((offs * p->bits) & 7))
+          & ((1 << p->bits) - 1);
+
+  c->type    = p->palette[idx];
+  c->light   = (p->light[offs >> 1] >> ((offs & 1) * 4)) & 0x0F;
+  c->meta    = p->meta ? p->meta[offs] : 0;
+  c->add     = p->add  ? p->add[offs]  : 0;
+  c->visible = CELL_VISIBLE (chnk, offs);
+}
 
-void ctr_world_chunk_buffer_init ()
+void ctr_chunk_packed_free (ctr_chunk_packed *p)
 {
-  int i;
-  for (i = 0; i < CTR_BUF_CHUNKS; i++)
+  ctr_prof_cnt.packed_chunks--;
+  ctr_prof_cnt.packed_chunks_size -= p->size;
+  safefree (p);
+}
+
+void ctr_chunk_unpack (ctr_chunk *chnk)
+{
+  if (!chnk->packed)
+    return;
+
+  ctr_chunk_packed *p = chnk->packed;
+  ctr_chunk_cells *cells = ctr_slab_alloc (&ctr_chunk_cells_slab);
+
+  unsigned int i;
+  for (i = 0; i < CHUNK_ALEN; i++)
     {
-      ctr_buffered_chunks_buf[i] = safemalloc (sizeof (ctr_chunk));
-      ctr_buffered_chunks++;
+      unsigned int idx = 0;
+      if (p->bits == 16)
+        idx = ((unsigned short *) p->types)[i];
+      else if (p->bits > 0)
+        idx = (p->types[(i * p->bits) >> 3] >> ((i * p->bits) & 7))
+              & ((1 << p->bits) - 1);
+
+      cells->type[i]  = p->palette[idx];
+      cells->light[i] = (p->light[i >> 1] >> ((i & 1) * 4)) & 0x0F;
     }
+
+  if (p->meta) memcpy (cells->meta, p->meta, CHUNK_ALEN);
+  else         memset (cells->meta, 0, CHUNK_ALEN);
+  if (p->add)  memcpy (cells->add, p->add, CHUNK_ALEN);
+  else         memset (cells->add, 0, CHUNK_ALEN);
+  cells->refcnt     = 0;
+  cells->share_next = 0;
+
+  chnk->cells = cells;
+
+  ctr_chunk_packed_free (chnk->packed);
+  chnk->packed = 0;
 }
 
-ctr_chunk *ctr_world_chunk (int x, int y, int z, int alloc)
+// Makes sure the summary of the chunk is up to date.
+void ctr_chunk_summary (ctr_chunk *chnk)
+{
+  if (chnk->summary_stale)
+    {
+      ctr_chunk_unpack (chnk);
+      ctr_chunk_summarize (chnk);
+    }
+}
+
+/* Returns a mask of the faces of the chunk that are completely covered
+ * by opaque cells, bit d for the face in CHUNK_* direction d.
+ */
+unsigned int ctr_chunk_opaque_faces (ctr_chunk *chnk)
 {
-  ctr_axis_array *xn = (ctr_axis_array *) ctr_axis_get (WORLD.y, y);
-  if (!xn)
+  unsigned int d, mask = 0;
+  ctr_chunk_summary (chnk);
+  for (d = 0; d < 6; d++)
+    if (chnk->face_opaque[d] == CHUNK_FACE_ALEN)
+      mask |= 1 << d;
+  return mask;
+}
+
+/* Returns true if no cell of the chunk can be seen: all cells are opaque
+ * and all six neighbours are loaded and opaque on the touching faces.
+ */
+int ctr_chunk_buried (ctr_chunk *chnk)
+{
+  unsigned int d;
+  ctr_chunk_summary (chnk);
+  if (chnk->opaque != CHUNK_ALEN)
+    return 0;
+
+  for (d = 0; d < 6; d++)
     {
-      if (alloc)
+      ctr_chunk *n = chnk->neighbours[d];
+      if (!n || !(ctr_chunk_opaque_faces (n) & (1 << CHUNK_OPPOSITE (d))))
+        return 0;
+    }
+  return 1;
+}
+
+/* Returns the offsets of the cells of the chunk with a light source or
+ * an active type, their number is in chnk->special_len.
+ */
+unsigned short *ctr_chunk_special (ctr_chunk *chnk)
+{
+  ctr_chunk_summary (chnk);
+  return chnk->special;
+}
+
+/* Marks the chunk as recently used, and unpacks it, so the
+ * cells can be accessed.
+ */
+void ctr_chunk_touch (ctr_chunk *chnk)
+{
+  chnk->touched = WORLD.tick;
+  if (chnk->packed)
+    ctr_chunk_unpack (chnk);
+}
+
+// Returns the (unpacked) neighbour chunk in direction dir, or 0.
+ctr_chunk *ctr_chunk_neighbour (ctr_chunk *chnk, int dir)
+{
+  ctr_chunk *n = chnk->neighbours[dir];
+  if (n)
+    ctr_chunk_touch (n);
+  return n;
+}
+
+#define LOAD_NEIGHBOUR_CHUNKS(c) \
+  ctr_chunk *top_chunk   = ctr_chunk_neighbour (c, CHUNK_TOP); \
+  ctr_chunk *bot_chunk   = ctr_chunk_neighbour (c, CHUNK_BOT); \
+  ctr_chunk *left_chunk  = ctr_chunk_neighbour (c, CHUNK_LEFT); \
+  ctr_chunk *right_chunk = ctr_chunk_neighbour (c, CHUNK_RIGHT); \
+  ctr_chunk *front_chunk = ctr_chunk_neighbour (c, CHUNK_FRONT); \
+  ctr_chunk *back_chunk  = ctr_chunk_neighbour (c, CHUNK_BACK);
+
+/* A halo is a copy of the type, light and transparency of a chunk's
+ * cells with a border of one cell around it, that holds the adjacent
+ * cells of the 6 neighbour chunks. Algorithms that look at the 6
+ * neighbours of every cell (visibility, meshing) can then run without
+ * any bounds checks: the neighbours of the cell at HALO_OFFS(x,y,z) are
+ * at +-1, +-HALO_SIZE and +-HALO_SIZE * HALO_SIZE.
+ *
+ * Border cells of missing neighbours, and the edges and corners of the
+ * border, are empty (type 0, no light).
+ *
+ * The light is only copied if CTR_HALO_LIGHT is requested, the border
+ * is only filled from the neighbours with CTR_HALO_NEIGHBOURS.
+ */
+#define CTR_HALO_NEIGHBOURS 0x1
+#define CTR_HALO_LIGHT      0x2
+
+#define HALO_SIZE (CHUNK_SIZE + 2)
+#define HALO_ALEN (HALO_SIZE * HALO_SIZE * HALO_SIZE)
+#define HALO_OFFS(x,y,z) \
+  (((x) + 1) + ((y) + 1) * HALO_SIZE + ((z) + 1) * (HALO_SIZE * HALO_SIZE))
+#define HALO_DX 1
+#define HALO_DY HALO_SIZE
+#define HALO_DZ (HALO_SIZE * HALO_SIZE)
+
+typedef struct _ctr_chunk_halo {
+    unsigned short type[HALO_ALEN];
+    unsigned char  light[HALO_ALEN];
+    unsigned char  transparent[HALO_ALEN];
+    int in_use;
+} ctr_chunk_halo;
+
+// The halos are reused, at most CTR_HALO_POOL can be in use at the same time.
+#define CTR_HALO_POOL 4
+static ctr_chunk_halo *ctr_halo_pool[CTR_HALO_POOL];
+
+static void ctr_chunk_halo_clear (ctr_chunk_halo *h, int flags)
+{
+  memset (h->type, 0, sizeof (h->type));
+  memset (h->transparent, OBJ_TRANSPARENT[0], sizeof (h->transparent));
+  if (flags & CTR_HALO_LIGHT)
+    memset (h->light, 0, sizeof (h->light));
+}
+
+/* Copies the cells with the chunk relative coordinates [x, ex) * [y, ey)
+ * * [z, ez) of chnk into the halo, shifted by dx/dy/dz.
+ */
+static void ctr_chunk_halo_copy (ctr_chunk_halo *h, ctr_chunk *chnk, int flags,
+                                 int x, int y, int z, int ex, int ey, int ez,
+                                 int dx, int dy, int dz)
+{
+  int ix, iy, iz;
+  for (iz = z; iz < ez; iz++)
+    for (iy = y; iy < ey; iy++)
+      {
+        unsigned int offs  = REL_POS2OFFS (x, iy, iz);
+        unsigned int hoffs = HALO_OFFS (x + dx, iy + dy, iz + dz);
+        int len = ex - x;
+        unsigned short *t = &(h->type[hoffs]);
+        unsigned char *tr = &(h->transparent[hoffs]);
+        memcpy (t, &(CELL_TYPE (chnk, offs)), len * sizeof (unsigned short));
+        for (ix = 0; ix < len; ix++)
+          tr[ix] = OBJ_TRANSPARENT[t[ix]];
+        if (flags & CTR_HALO_LIGHT)
+          memcpy (&(h->light[hoffs]), &(CELL_LIGHT (chnk, offs)), len);
+      }
+}
+
+/* Returns a halo of the (unpacked) chunk from the pool, flags are a
+ * combination of the CTR_HALO_* flags. Hand it back with
+ * ctr_chunk_halo_put () when done.
+ */
+ctr_chunk_halo *ctr_chunk_halo_get (ctr_chunk *chnk, int flags)
+{
+  ctr_chunk_halo *h = 0;
+  int i;
+  for (i = 0; i < CTR_HALO_POOL; i++)
+    {
+      if (!ctr_halo_pool[i])
         {
-          xn = ctr_axis_array_new ();
-          ctr_axis_add (WORLD.y, y, xn);
+          ctr_halo_pool[i] = safemalloc (sizeof (ctr_chunk_halo));
+          ctr_halo_pool[i]->in_use = 0;
         }
-      else
-        return 0;
+
+      if (!ctr_halo_pool[i]->in_use)
+        {
+          h = ctr_halo_pool[i];
+          break;
+        }
+    }
+  if (!h)
+    croak ("Games::Construder: more than %d chunk halos in use", CTR_HALO_POOL);
+  h->in_use = 1;
+
+  ctr_chunk_halo_clear (h, flags);
+
+  int S = CHUNK_SIZE;
+  ctr_chunk_halo_copy (h, chnk, flags, 0, 0, 0, S, S, S, 0, 0, 0);
+
+  if (flags & CTR_HALO_NEIGHBOURS)
+    {
+      LOAD_NEIGHBOUR_CHUNKS(chnk);
+      // the one cell thick face of each neighbour that touches chnk:
+      if (left_chunk)
+        ctr_chunk_halo_copy (h, left_chunk,   flags, S - 1, 0, 0, S, S, S, -S, 0, 0);
+      if (right_chunk)
+        ctr_chunk_halo_copy (h, right_chunk,  flags, 0, 0, 0, 1, S, S,  S, 0, 0);
+      if (bot_chunk)
+        ctr_chunk_halo_copy (h, bot_chunk,    flags, 0, S - 1, 0, S, S, S, 0, -S, 0);
+      if (top_chunk)
+        ctr_chunk_halo_copy (h, top_chunk,    flags, 0, 0, 0, S, 1, S, 0,  S, 0);
+      if (front_chunk)
+        ctr_chunk_halo_copy (h, front_chunk,  flags, 0, 0, S - 1, S, S, S, 0, 0, -S);
+      if (back_chunk)
+        ctr_chunk_halo_copy (h, back_chunk,   flags, 0, 0, 0, S, S, 1, 0, 0,  S);
+    }
+
+  return h;
+}
+
+void ctr_chunk_halo_put (ctr_chunk_halo *h)
+{
+  h->in_use = 0;
+}
+
+/* The visibility pass works on bit rows along x: one bit per cell, plus
+ * one bit for the neighbour cell on either end.
+ */
+#if CHUNK_SIZE + 2 > 63
+# error "the visibility pass needs CHUNK_SIZE + 2 bits in an unsigned long long"
+#endif
+typedef unsigned long long ctr_vis_row;
+#define CTR_VIS_ROW_ALL ((1ULL << (CHUNK_SIZE + 2)) - 1)
+
+// Transparency of the cell at offs of a chunk that might be packed.
+static ctr_vis_row ctr_chunk_transparent_at (ctr_chunk *chnk, unsigned int offs)
+{
+  if (chnk->packed)
+    {
+      ctr_cell c;
+      ctr_chunk_packed_cell (chnk, offs, &c);
+      return OBJ_TRANSPARENT[c.type];
+    }
+  return OBJ_TRANSPARENT[CELL_TYPE (chnk, offs)];
+}
+
+/* Returns the transparency of the row of cells along x at y, z of the
+ * neighbour chunk n, shifted like the rows of the visibility pass, or
+ * all bits set if there is no neighbour.
+ */
+static ctr_vis_row ctr_vis_neighbour_row (ctr_chunk *n, int y, int z)
+{
+  if (!n)
+    return CTR_VIS_ROW_ALL;
+
+  ctr_vis_row r = 0;
+  unsigned int offs = REL_POS2OFFS (0, y, z);
+  int x;
+  for (x = 0; x < CHUNK_SIZE; x++, offs++)
+    r |= ctr_chunk_transparent_at (n, offs) << (x + 1);
+  return r;
+}
+
+// ORs the lowest CHUNK_SIZE bits of row into the visible bits at offs.
+static void ctr_vis_store_row (unsigned char *visible, unsigned int offs, ctr_vis_row row)
+{
+  unsigned int n = CHUNK_SIZE;
+  while (row && n)
+    {
+      unsigned int sh   = offs & 7,
+                   take = 8 - sh < n ? 8 - sh : n;
+      visible[offs >> 3] |= (row & ((1 << take) - 1)) << sh;
+      row  >>= take;
+      offs  += take;
+      n     -= take;
     }
+}
+
+/* Calculate the visibility of the blocks. If a block is surrounded by
+ * 6 non transparent blocks it's considered non visible. Cells of
+ * neighbour chunks that aren't loaded count as empty.
+ *
+ * The transparency of the chunk and of the touching faces of its
+ * neighbours is packed into bit rows along x first, then each row of
+ * visible cells is the OR of the shifted row itself and the rows above,
+ * below, in front and behind it, masked with the non empty cells.
+ */
+void ctr_world_chunk_calc_visibility (ctr_chunk *chnk)
+{
+  static ctr_vis_row T[CHUNK_SIZE + 2][CHUNK_SIZE + 2]; // [z + 1][y + 1], bit x + 1
+  static ctr_vis_row N[CHUNK_SIZE][CHUNK_SIZE];         // [z][y], bit x: non empty
+
+  chnk->vis_stale = 0;
+  memset (chnk->visible, 0, CHUNK_VIS_LEN);
+
+  // nothing to see in empty chunks and chunks buried in opaque ones:
+  ctr_chunk_summary (chnk);
+  if (chnk->nonair == 0 || ctr_chunk_buried (chnk))
+    return;
+
+  CTR_PROF_BEGIN (t_start);
 
-  ctr_axis_array *zn = (ctr_axis_array *) ctr_axis_get (xn, x);
-  if (!zn)
+  ctr_chunk *left  = chnk->neighbours[CHUNK_LEFT],
+            *right = chnk->neighbours[CHUNK_RIGHT];
+  unsigned short *type = chnk->cells->type;
+  int x, y, z;
+
+  for (z = 0; z < CHUNK_SIZE; z++)
+    for (y = 0; y < CHUNK_SIZE; y++)
+      {
+        unsigned int offs = REL_POS2OFFS (0, y, z);
+        ctr_vis_row t = 0, n = 0;
+        for (x = 0; x < CHUNK_SIZE; x++)
+          {
+            unsigned short c = type[offs + x];
+            t |= (ctr_vis_row) OBJ_TRANSPARENT[c] << (x + 1);
+            n |= (ctr_vis_row) (c != 0) << x;
+          }
+
+        t |= left  ? ctr_chunk_transparent_at (left,  REL_POS2OFFS (CHUNK_SIZE - 1, y, z)) : 1;
+        t |= (right ? ctr_chunk_transparent_at (right, REL_POS2OFFS (0, y, z)) : 1)
+             << (CHUNK_SIZE + 1);
+        T[z + 1][y + 1] = t;
+        N[z][y]         = n;
+      }
+
+  // the faces of the bottom, top, front and back neighbours:
+  for (z = 0; z < CHUNK_SIZE; z++)
+    {
+      T[z + 1][0]              = ctr_vis_neighbour_row (chnk->neighbours[CHUNK_BOT], CHUNK_SIZE - 1, z);
+      T[z + 1][CHUNK_SIZE + 1] = ctr_vis_neighbour_row (chnk->neighbours[CHUNK_TOP], 0, z);
+    }
+  for (y = 0; y < CHUNK_SIZE; y++)
     {
-      if (alloc)
+      T[0][y + 1]              = ctr_vis_neighbour_row (chnk->neighbours[CHUNK_FRONT], y, CHUNK_SIZE - 1);
+      T[CHUNK_SIZE + 1][y + 1] = ctr_vis_neighbour_row (chnk->neighbours[CHUNK_BACK], y, 0);
+    }
+
+  for (z = 0; z < CHUNK_SIZE; z++)
+    for (y = 0; y < CHUNK_SIZE; y++)
+      {
+        ctr_vis_row t = T[z + 1][y + 1];
+        ctr_vis_row open =
+            (t << 1) | (t >> 1)
+          | T[z + 1][y] | T[z + 1][y + 2]
+          | T[z][y + 1] | T[z + 2][y + 1];
+        ctr_vis_row vis = (open >> 1) & N[z][y];
+        if (vis)
+          ctr_vis_store_row (chnk->visible, REL_POS2OFFS (0, y, z), vis);
+      }
+
+  CTR_PROF_END (CTR_PROF_VISIBILITY, t_start);
+}
+
+/* Recomputes the visibility of the chunk if it (or a neighbour) changed
+ * since the last time. Needs to be called before the visible bits are
+ * read.
+ */
+void ctr_chunk_visibility (ctr_chunk *chnk)
+{
+  if (!ctr_world_visibility || !chnk->vis_stale)
+    return;
+  ctr_chunk_unpack (chnk);
+  ctr_world_chunk_calc_visibility (chnk);
+}
+
+/* Turns the maintenance of the visible bits on or off. While it's off
+ * the bits are left as they were set by the cell and chunk data.
+ */
+void ctr_world_set_visibility (int enable)
+{
+  ctr_world_visibility = enable;
+}
+
+// Same as ctr_world_get_chunk_data (), but works on packed chunks too.
+void ctr_world_get_any_chunk_data (ctr_chunk *chnk, unsigned char *data)
+{
+  CTR_PROF_BEGIN (t_start);
+  if (!chnk->packed)
+    ctr_world_get_chunk_data (chnk, data);
+  else
+    {
+      ctr_cell c;
+      unsigned int i;
+      for (i = 0; i < CHUNK_ALEN; i++)
         {
-          zn = ctr_axis_array_new ();
-          ctr_axis_add (xn, x, zn);
+          ctr_chunk_packed_cell (chnk, i, &c);
+          ctr_get_data_from_cell (&c, data + (i * 4));
         }
-      else
-        return 0;
+    }
+  CTR_PROF_END (CTR_PROF_ENCODE, t_start);
+}
+
+/* Stores the cells of the chunk that changed after the version since in
+ * data, CTR_CHUNK_CHANGE_LEN bytes per cell: the offset of the cell as
+ * big endian 16 bit value (like the cell data) followed by the cell data
+ * like ctr_world_get_chunk_data () stores it. data needs room for CTR_CHUNK_CHANGES cells.
+ *
+ * Returns the number of cells, or -1 if the change log doesn't reach back
+ * to since, then the whole chunk has to be fetched.
+ */
+int ctr_chunk_get_changes (ctr_chunk *chnk, unsigned long long since, unsigned char *data)
+{
+  if (since >= chnk->version)
+    return 0;
+
+  ctr_chunk_changes *chg = chnk->changes;
+  if (!chg || since < chg->since)
+    return -1;
+
+  if (chnk->packed)
+    ctr_chunk_unpack (chnk);
+
+  int cnt = 0;
+  int i, j;
+  for (i = chg->len - 1; i >= 0 && chg->log[i].version > since; i--)
+    {
+      // skip cells that were changed again later:
+      for (j = i + 1; j < chg->len; j++)
+        if (chg->log[j].offs == chg->log[i].offs)
+          break;
+      if (j < chg->len)
+        continue;
+
+      unsigned int offs = chg->log[i].offs;
+      ctr_cell c;
+      ctr_chunk_get_cell (chnk, offs, &c);
+      unsigned char *ptr = data + cnt * CTR_CHUNK_CHANGE_LEN;
+      ptr[0] = offs >> 8;
+      ptr[1] = offs & 0xFF;
+      ctr_get_data_from_cell (&c, ptr + 2);
+      cnt++;
+    }
+
+  return cnt;
+}
+
+/* Returns the chunk at the chunk coordinates x, y, z. If alloc is true
+ * a new empty chunk is created if there is none. The returned chunk might
+ * still be packed, see ctr_world_chunk () if you want to access its cells.
+ */
+ctr_chunk *ctr_world_chunk_lookup (int x, int y, int z, int alloc)
+{
+  ctr_chunk *c;
+  if (++ctr_prof_tmr[CTR_PROF_CHUNK_LOOKUP].calls & CTR_PROF_LOOKUP_SAMPLE)
+    c = (ctr_chunk *) ctr_chunk_dir_get (&WORLD.chunks, x, y, z);
+  else
+    {
+      CTR_PROF_BEGIN (t);
+      c = (ctr_chunk *) ctr_chunk_dir_get (&WORLD.chunks, x, y, z);
+      ctr_prof_record (CTR_PROF_CHUNK_LOOKUP, ctr_prof_now () - t);
     }
 
-  ctr_chunk *c = (ctr_chunk *) ctr_axis_get (zn, z);
   if (alloc && !c)
     {
-      if (ctr_buffered_chunks > 0)
-        c = ctr_buffered_chunks_buf[--ctr_buffered_chunks];
-      else
-        c = safemalloc (sizeof (ctr_chunk));
+      ctr_chunk_cells *cells = ctr_slab_alloc (&ctr_chunk_cells_slab);
+      int d;
+      c = ctr_slab_try_alloc (&ctr_chunk_slab);
+      if (!c)
+        {
+          ctr_slab_free (&ctr_chunk_cells_slab, cells);
+          ctr_slab_budget_exceeded (&ctr_chunk_slab);
+        }
 
       ctr_prof_cnt.allocated_chunks++;
       memset (c, 0, sizeof (ctr_chunk));
+      memset (cells, 0, sizeof (ctr_chunk_cells));
+      c->cells = cells;
+      c->touched = WORLD.tick;
       c->x = x;
       c->y = y;
       c->z = z;
-      ctr_axis_add (zn, z, c);
+      c->uniform = 1;
+      if (!OBJ_TRANSPARENT[0])
+        {
+          c->opaque = CHUNK_ALEN;
+          for (d = 0; d < 6; d++)
+            c->face_opaque[d] = CHUNK_FACE_ALEN;
+        }
+      ctr_chunk_dir_add (&WORLD.chunks, x, y, z, c);
+
+      for (d = 0; d < 6; d++)
+        {
+          ctr_chunk *n =
+            ctr_chunk_dir_get (&WORLD.chunks,
+                               x + ctr_chunk_neighbour_offs[d][0],
+                               y + ctr_chunk_neighbour_offs[d][1],
+                               z + ctr_chunk_neighbour_offs[d][2]);
+          c->neighbours[d] = n;
+          if (n)
+            n->neighbours[CHUNK_OPPOSITE (d)] = c;
+        }
     }
 
   return c;
 }
 
+// Like ctr_world_chunk_lookup (), but the returned chunk is unpacked.
+ctr_chunk *ctr_world_chunk (int x, int y, int z, int alloc)
+{
+  ctr_chunk *c = ctr_world_chunk_lookup (x, y, z, alloc);
+  if (c)
+    ctr_chunk_touch (c);
+  return c;
+}
+
 ctr_chunk *ctr_world_chunk_at (double x, double y, double z, int alloc)
 {
-  vec3_init (pos, x, y, z);
-  vec3_s_div (pos, CHUNK_SIZE);
-  vec3_floor (pos);
-  return ctr_world_chunk (pos[0], pos[1], pos[2], alloc);
+  int xi = floor (x), yi = floor (y), zi = floor (z);
+  return ctr_world_chunk (CHUNK_DIV (xi), CHUNK_DIV (yi), CHUNK_DIV (zi), alloc);
 }
 
 void ctr_world_purge_chunk (int x, int y, int z)
 {
   //printf ("PURGE CHUNK %d %d %d\n", x, y, z);
-  ctr_axis_array *xn = (ctr_axis_array *) ctr_axis_get (WORLD.y, y);
-  if (!xn)
-    return;
-
-  ctr_axis_array *zn = (ctr_axis_array *) ctr_axis_get (xn, x);
-  if (!zn)
-    return;
-
-  ctr_chunk *c = (ctr_chunk *) ctr_axis_remove (zn, z);
+  ctr_chunk *c = (ctr_chunk *) ctr_chunk_dir_remove (&WORLD.chunks, x, y, z);
   if (c)
     {
-      if (ctr_buffered_chunks < CTR_BUF_CHUNKS)
-        ctr_buffered_chunks_buf[ctr_buffered_chunks++] = c;
-      else
-        safefree (c);
+      int d;
+      for (d = 0; d < 6; d++)
+        if (c->neighbours[d])
+          {
+            c->neighbours[d]->neighbours[CHUNK_OPPOSITE (d)] = 0;
+            c->neighbours[d]->vis_stale = 1;
+          }
+
+      if (c->packed)
+        {
+          ctr_chunk_packed_free (c->packed);
+          c->packed = 0;
+        }
+
+      if (c->cells)
+        ctr_chunk_cells_release (c->cells);
+      if (c->changes)
+        ctr_slab_free (&ctr_chunk_changes_slab, c->changes);
+      if (c->special)
+        safefree (c->special);
+      ctr_slab_free (&ctr_chunk_slab, c);
       ctr_prof_cnt.allocated_chunks--;
+    }
+}
 
-      if (ctr_axis_empty (zn))
+#define CHUNKS_IN_SECTOR (CHUNKS_P_SECTOR * CHUNKS_P_SECTOR * CHUNKS_P_SECTOR)
+
+/* The chunks of a sector are stored one after another in this order
+ * (z is the innermost loop), like the sector files store them.
+ */
+#define FOR_SECTOR_CHUNKS(sx,sy,sz,x,y,z) \
+  for (x = (sx) * CHUNKS_P_SECTOR; x < ((sx) + 1) * CHUNKS_P_SECTOR; x++) \
+    for (y = (sy) * CHUNKS_P_SECTOR; y < ((sy) + 1) * CHUNKS_P_SECTOR; y++) \
+      for (z = (sz) * CHUNKS_P_SECTOR; z < ((sz) + 1) * CHUNKS_P_SECTOR; z++)
+
+/* Stores the data of all chunks of the sector at sx, sy, sz in data,
+ * which has room for CHUNKS_IN_SECTOR * CHUNK_DATA_LEN bytes. lens gets
+ * the length of each chunk's data, 0 for chunks that are not allocated.
+ * Chunks with the same data as an earlier chunk j of the sector are
+ * stored only once, their length is -(j + 1).
+ * Returns the number of bytes written.
+ */
+unsigned int ctr_world_get_sector_data (int sx, int sy, int sz, unsigned char *data, int *lens)
+{
+  ctr_chunk_cells   *cells[CHUNKS_IN_SECTOR];
+  unsigned long long hashes[CHUNKS_IN_SECTOR];
+  unsigned int       offsets[CHUNKS_IN_SECTOR];
+
+  CTR_PROF_BEGIN (t_start);
+  unsigned int len = 0;
+  int x, y, z, i = 0, j;
+  FOR_SECTOR_CHUNKS(sx, sy, sz, x, y, z)
+    {
+      ctr_chunk *chnk = ctr_world_chunk_lookup (x, y, z, 0);
+      cells[i] = 0;
+      lens[i]  = 0;
+      if (chnk)
         {
-          ctr_axis_remove (xn, x);
-          ctr_axis_array_free (zn);
+          // chunks that share their cells have the same data for sure:
+          if (chnk->cells && chnk->cells->refcnt > 1)
+            {
+              for (j = 0; j < i; j++)
+                if (cells[j] == chnk->cells)
+                  break;
+              if (j < i)
+                {
+                  // refer to the chunk with the data, never to a repeat:
+                  lens[i] = lens[j] < 0 ? lens[j] : -(j + 1);
+                  i++;
+                  continue;
+                }
+              cells[i] = chnk->cells;
+            }
 
-          if (ctr_axis_empty (xn))
+          unsigned char *d = data + len;
+          ctr_world_get_any_chunk_data (chnk, d);
+          hashes[i] = ctr_chunk_data_hash (d);
+
+          for (j = 0; j < i; j++)
+            if (lens[j] > 0 && hashes[j] == hashes[i]
+                && !memcmp (data + offsets[j], d, CHUNK_DATA_LEN))
+              break;
+          if (j < i)
+            lens[i] = lens[j] < 0 ? lens[j] : -(j + 1);
+          else
             {
-              ctr_axis_remove (WORLD.y, y);
-              ctr_axis_array_free (xn);
+              offsets[i] = len;
+              lens[i]    = CHUNK_DATA_LEN;
+              len       += CHUNK_DATA_LEN;
             }
         }
+      i++;
     }
+  CTR_PROF_END (CTR_PROF_SECTOR_EXPORT, t_start);
+
+  return len;
 }
 
-// Haven't tested this function in a long time now. Not sure if it still works :)
-void ctr_world_dump ()
+/* Sets all chunks of the sector at sx, sy, sz from data (of len bytes),
+ * which holds the chunks in the order of ctr_world_get_sector_data ().
+ * Chunks with a length of 0 in lens are left alone, chunks with the same
+ * data share their cells. No change callbacks are called, the caller is
+ * expected to update the whole sector at once.
+ *
+ * Returns the number of chunks that were set, or -1 if the lengths
+ * don't match the data.
+ */
+int ctr_world_set_sector_data (int sx, int sy, int sz, unsigned char *data, unsigned int len, int *lens)
 {
-  unsigned int x, y, z;
-  printf ("WORLD:\n");
-  for (y = 0; y < WORLD.y->len; y++)
+  unsigned int offsets[CHUNKS_IN_SECTOR];
+  unsigned int offs = 0;
+  int i;
+  for (i = 0; i < CHUNKS_IN_SECTOR; i++)
+    {
+      if (lens[i] < 0)
+        {
+          // a repeat of an earlier chunk with data:
+          int j = -lens[i] - 1;
+          if (j >= i || lens[j] != CHUNK_DATA_LEN)
+            return -1;
+          offsets[i] = offsets[j];
+          continue;
+        }
+
+      if (lens[i] != 0 && lens[i] != CHUNK_DATA_LEN)
+        return -1;
+      offsets[i] = offs;
+      offs += lens[i];
+    }
+  if (offs != len)
+    return -1;
+
+  CTR_PROF_BEGIN (t_start);
+  int cnt = 0;
+  int x, y, z;
+  i = 0;
+  FOR_SECTOR_CHUNKS(sx, sy, sz, x, y, z)
     {
-      ctr_axis_node *any = &(WORLD.y->nodes[y]);
-      ctr_axis_array *xa = (ctr_axis_array *) any->ptr;
+      if (lens[i])
+        {
+          unsigned char *d = data + offsets[i];
+          ctr_chunk *chnk = ctr_world_chunk (x, y, z, 1);
+          ctr_world_set_chunk_from_data (chnk, d, CHUNK_DATA_LEN);
+          ctr_chunk_share (chnk, ctr_chunk_data_hash (d));
+          cnt++;
+        }
+      i++;
+    }
+  CTR_PROF_END (CTR_PROF_SECTOR_IMPORT, t_start);
 
-      for (x = 0; x < xa->len; x++)
+  return cnt;
+}
+
+/* Advances the world tick counter, and packs all chunks that were
+ * not touched for pack_after ticks, unless they can share their cells
+ * with another chunk. A pack_after of 0 disables packing.
+ * Returns the number of chunks that were packed.
+ */
+int ctr_world_tick (unsigned int pack_after)
+{
+  static unsigned char data[CHUNK_DATA_LEN];
+  int cnt = 0;
+  unsigned int i;
+
+  WORLD.tick++;
+  if (pack_after == 0)
+    return 0;
+
+  // all cold chunks get a chance to find each other before the rest is packed,
+  // cells with a refcnt were tried already and are unshared when changed:
+  for (i = 0; i <= WORLD.chunks.mask; i++)
+    {
+      ctr_chunk *c = (ctr_chunk *) WORLD.chunks.entries[i].ptr;
+      if (c && !c->packed && !c->cells->refcnt
+          && (WORLD.tick - c->touched) >= pack_after)
         {
-          ctr_axis_node *anx = &(xa->nodes[x]);
-          ctr_axis_array *za = (ctr_axis_array *) anx->ptr;
-          if (za)
-            {
-              for (z = 0; z < za->len; z++)
-                {
-                  ctr_axis_node *anz = &(za->nodes[z]);
-                  ctr_chunk *cnk = (ctr_chunk *) anz->ptr;
-                  printf ("[%d %d %d] %p(%d,%d,%d)\n", anx->coord, any->coord, anz->coord, anz->ptr, cnk->x, cnk->y, cnk->z);
-                }
-            }
+          ctr_world_get_chunk_data (c, data);
+          ctr_chunk_share (c, ctr_chunk_data_hash (data));
         }
     }
+
+  for (i = 0; i <= WORLD.chunks.mask; i++)
+    {
+      ctr_chunk *c = (ctr_chunk *) WORLD.chunks.entries[i].ptr;
+      if (c && !c->packed && (WORLD.tick - c->touched) >= pack_after)
+        cnt += ctr_chunk_pack (c);
+    }
+
+  return cnt;
+}
+
+void ctr_world_dump ()
+{
+  unsigned int i;
+  printf ("WORLD (%d chunks):\n", WORLD.chunks.len);
+  for (i = 0; i <= WORLD.chunks.mask; i++)
+    {
+      ctr_chunk *cnk = (ctr_chunk *) WORLD.chunks.entries[i].ptr;
+      if (cnk)
+        printf ("[%d] %p(%d,%d,%d)\n", i, cnk, cnk->x, cnk->y, cnk->z);
+    }
 }
@@ -15,10 +15,15 @@
  * You should have received a copy of the GNU Affero General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-/* This file contains the implementation of the data structure
- * that will store the chunks of the world.
- * It's basically a primitively implemented sparse array for each
- * coordinate axis. The nesting of this arrays is done in world.c.
+/* This file contains the implementation of the data structures
+ * that can store the chunks of the world.
+ *
+ * The chunk directory is a hash table with open addressing (linear probing),
+ * keyed by the packed chunk coordinates. This is what world.c uses.
+ *
+ * The axis arrays are a primitively implemented sparse array for each
+ * coordinate axis, which used to be nested for storing the world.
+ * They are kept for comparison in benchmark.c.
  */
 
 typedef struct _ctr_axis_node {
@@ -32,6 +37,21 @@ typedef struct _ctr_axis_array {
    unsigned int alloc;
 } ctr_axis_array;
 
+/* The arrays and their first block of nodes come from these slabs,
+ * only arrays that grow larger than that use the heap.
+ */
+#define CTR_AXIS_FIRST_ALLOC 64
+static ctr_slab ctr_axis_slab;
+static ctr_slab ctr_axis_nodes_slab;
+
+void ctr_axis_nodes_free (ctr_axis_node *nodes, unsigned int alloc)
+{
+  if (alloc == CTR_AXIS_FIRST_ALLOC)
+    ctr_slab_free (&ctr_axis_nodes_slab, nodes);
+  else
+    safefree (nodes);
+}
+
 
 void ctr_axis_array_grow (ctr_axis_array *arr, unsigned int min_size)
 {
@@ -40,8 +60,8 @@ void ctr_axis_array_grow (ctr_axis_array *arr, unsigned int min_size)
 
   if (arr->alloc == 0)
     {
-      arr->alloc = 64;
-      arr->nodes = safemalloc (sizeof (ctr_axis_node) * arr->alloc);
+      arr->alloc = CTR_AXIS_FIRST_ALLOC;
+      arr->nodes = ctr_slab_alloc (&ctr_axis_nodes_slab);
       ctr_prof_cnt.allocated_axises_size += sizeof (ctr_axis_node) * arr->alloc;
       memset (arr->nodes, 0, sizeof (ctr_axis_node) * arr->alloc);
       arr->len = 0;
@@ -60,13 +80,20 @@ void ctr_axis_array_grow (ctr_axis_array *arr, unsigned int min_size)
   assert (newnodes);
   memset (newnodes, 0, sizeof (ctr_axis_node) * arr->alloc);
   memcpy (newnodes, arr->nodes, sizeof (ctr_axis_node) * oa);
-  safefree (arr->nodes);
+  ctr_axis_nodes_free (arr->nodes, oa);
   arr->nodes = newnodes;
 }
 
 ctr_axis_array *ctr_axis_array_new ()
 {
-  ctr_axis_array *na = safemalloc (sizeof (ctr_axis_array));
+  if (!ctr_axis_slab.item_size)
+    {
+      ctr_slab_init (&ctr_axis_slab, "axis array", sizeof (ctr_axis_array));
+      ctr_slab_init (&ctr_axis_nodes_slab, "axis array nodes",
+                     sizeof (ctr_axis_node) * CTR_AXIS_FIRST_ALLOC);
+    }
+
+  ctr_axis_array *na = ctr_slab_alloc (&ctr_axis_slab);
   ctr_prof_cnt.allocated_axises++;
   memset (na, 0, sizeof (ctr_axis_array));
   ctr_axis_array_grow (na, 1);
@@ -83,8 +110,8 @@ void ctr_axis_array_free (ctr_axis_array *a)
   ctr_prof_cnt.allocated_axises_size -= sizeof (ctr_axis_node) * a->alloc;
   ctr_prof_cnt.allocated_axises--;
   if (a->nodes)
-    safefree (a->nodes);
-  safefree (a);
+    ctr_axis_nodes_free (a->nodes, a->alloc);
+  ctr_slab_free (&ctr_axis_slab, a);
 }
 
 void ctr_axis_array_dump (ctr_axis_array *arr)
@@ -191,3 +218,139 @@ void *ctr_axis_remove (ctr_axis_array *arr, int coord)
     return ctr_axis_array_remove_at (arr, idx);
   return 0;
 }
+
+/* The chunk directory. Chunk coordinates are packed into one 64 bit key
+ * with 21 bits per axis, which is way more than the world will ever
+ * need (+-1048576 chunks in every direction).
+ */
+#define CTR_CHUNK_DIR_KEY(x,y,z) \
+  (  (((unsigned long long) (x) & 0x1FFFFF) << 42) \
+   | (((unsigned long long) (y) & 0x1FFFFF) << 21) \
+   |  ((unsigned long long) (z) & 0x1FFFFF))
+
+typedef struct _ctr_chunk_dir_entry {
+    unsigned long long key;
+    void *ptr; // 0 marks an empty slot
+} ctr_chunk_dir_entry;
+
+typedef struct _ctr_chunk_dir {
+    ctr_chunk_dir_entry *entries;
+    unsigned int bits;  // log2 of the number of slots
+    unsigned int mask;  // number of slots - 1
+    unsigned int len;
+} ctr_chunk_dir;
+
+// Fibonacci hashing, the upper bits of the product are the well mixed ones.
+#define CTR_CHUNK_DIR_SLOT(dir,key) \
+  ((unsigned int) (((key) * 0x9E3779B97F4A7C15ULL) >> (64 - (dir)->bits)))
+
+void ctr_chunk_dir_alloc (ctr_chunk_dir *dir, unsigned int bits)
+{
+  unsigned int slots = 1 << bits;
+  dir->entries = safemalloc (sizeof (ctr_chunk_dir_entry) * slots);
+  memset (dir->entries, 0, sizeof (ctr_chunk_dir_entry) * slots);
+  dir->bits = bits;
+  dir->mask = slots - 1;
+  dir->len  = 0;
+  ctr_prof_cnt.chunk_dir_size += sizeof (ctr_chunk_dir_entry) * slots;
+}
+
+void ctr_chunk_dir_init (ctr_chunk_dir *dir)
+{
+  ctr_chunk_dir_alloc (dir, 12);
+}
+
+void ctr_chunk_dir_free (ctr_chunk_dir *dir)
+{
+  ctr_prof_cnt.chunk_dir_size -= sizeof (ctr_chunk_dir_entry) * (dir->mask + 1);
+  safefree (dir->entries);
+  dir->entries = 0;
+  dir->len = 0;
+}
+
+// Returns the slot the key is stored in, or the empty slot where it belongs.
+unsigned int ctr_chunk_dir_find (ctr_chunk_dir *dir, unsigned long long key)
+{
+  unsigned int i = CTR_CHUNK_DIR_SLOT (dir, key);
+  while (dir->entries[i].ptr && dir->entries[i].key != key)
+    i = (i + 1) & dir->mask;
+  return i;
+}
+
+void ctr_chunk_dir_grow (ctr_chunk_dir *dir)
+{
+  ctr_chunk_dir_entry *old = dir->entries;
+  unsigned int oslots = dir->mask + 1;
+
+  ctr_prof_cnt.chunk_dir_size -= sizeof (ctr_chunk_dir_entry) * oslots;
+  ctr_chunk_dir_alloc (dir, dir->bits + 1);
+
+  unsigned int i;
+  for (i = 0; i < oslots; i++)
+    {
+      if (!old[i].ptr)
+        continue;
+
+      unsigned int j = ctr_chunk_dir_find (dir, old[i].key);
+      dir->entries[j] = old[i];
+      dir->len++;
+    }
+
+  safefree (old);
+}
+
+void *ctr_chunk_dir_get (ctr_chunk_dir *dir, int x, int y, int z)
+{
+  unsigned int i = ctr_chunk_dir_find (dir, CTR_CHUNK_DIR_KEY (x, y, z));
+  return dir->entries[i].ptr;
+}
+
+void *ctr_chunk_dir_add (ctr_chunk_dir *dir, int x, int y, int z, void *ptr)
+{
+  assert (ptr);
+
+  // keep the load factor below 1/2, so probe sequences stay short:
+  if ((dir->len + 1) * 2 > dir->mask + 1)
+    ctr_chunk_dir_grow (dir);
+
+  unsigned long long key = CTR_CHUNK_DIR_KEY (x, y, z);
+  unsigned int i = ctr_chunk_dir_find (dir, key);
+  void *oldptr = dir->entries[i].ptr;
+  if (!oldptr)
+    dir->len++;
+
+  dir->entries[i].key = key;
+  dir->entries[i].ptr = ptr;
+  return oldptr;
+}
+
+/* Removal shifts the following entries of the probe sequence back,
+ * so we don't need any tombstones and lookups stay fast under churn.
+ */
+void *ctr_chunk_dir_remove (ctr_chunk_dir *dir, int x, int y, int z)
+{
+  unsigned int i = ctr_chunk_dir_find (dir, CTR_CHUNK_DIR_KEY (x, y, z));
+  void *ptr = dir->entries[i].ptr;
+  if (!ptr)
+    return 0;
+
+  unsigned int j = i;
+  for (;;)
+    {
+      j = (j + 1) & dir->mask;
+      if (!dir->entries[j].ptr)
+        break;
+
+      // move entry j to the hole at i, unless its home lies cyclically in (i, j]
+      unsigned int k = CTR_CHUNK_DIR_SLOT (dir, dir->entries[j].key);
+      if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+        continue;
+
+      dir->entries[i] = dir->entries[j];
+      i = j;
+    }
+
+  dir->entries[i].ptr = 0;
+  dir->len--;
+  return ptr;
+}
@@ -19,9 +19,11 @@
 /* This file implements setting up a "drawing context" over a part of the
  * world. The main purpose is to make sure chunks can be quickly accessed
  * for the mutation operations or the light algorithm.
+ *
+ * There can be any number of query contexts (see ctr_world_query_new ()),
+ * the ctr_world_query_* functions work on the selected one, which is
+ * a default context unless another one is selected.
  */
-#define DRAW_CONTEXT_MAX_SIZE (20 * 20 * 20)
-
 typedef struct _ctr_world_query {
     // Chunk coordinates.
     int chnk_x, chnk_y, chnk_z,
@@ -30,8 +32,9 @@ typedef struct _ctr_world_query {
     // Size of context in chunks.
     int x_w, y_w, z_w;
 
-    // The "loaded" chunks.
-    ctr_chunk *chunks[DRAW_CONTEXT_MAX_SIZE];
+    // The "loaded" chunks, room for chunks_len of them.
+    ctr_chunk  **chunks;
+    unsigned int chunks_len;
 
     // Flag that we tried to fetch chunks from the global data structure.
     int loaded;
@@ -39,14 +42,51 @@ typedef struct _ctr_world_query {
 
 #define QUERY_CHUNK(x,y,z) QUERY_CONTEXT.chunks[x + y * (QUERY_CONTEXT.x_w) + z * (QUERY_CONTEXT.x_w * QUERY_CONTEXT.y_w)]
 
-static ctr_world_query QUERY_CONTEXT;
+static ctr_world_query  ctr_world_query_default;
+static ctr_world_query *ctr_world_query_cur = &ctr_world_query_default;
+
+// For XS functions that set up and use a context in one call, so they
+// don't disturb the one the caller has set up.
+static ctr_world_query  ctr_world_query_scratch;
+
+#define QUERY_CONTEXT (*ctr_world_query_cur)
+
+// Selects q for the functions below, the previous selection is kept
+// on the perl save stack and restored by QUERY_DONE, or when a croak
+// unwinds the stack. A q of 0 keeps the current context.
+#define QUERY_USE(q) \
+  ENTER; \
+  SAVEVPTR (ctr_world_query_cur); \
+  if (q) ctr_world_query_cur = (q)
+// Like QUERY_USE, for the static contexts, which are never 0.
+#define QUERY_USE_FIXED(q) \
+  ENTER; \
+  SAVEVPTR (ctr_world_query_cur); \
+  ctr_world_query_cur = (q)
+#define QUERY_DONE() LEAVE
+
+ctr_world_query *ctr_world_query_new ()
+{
+  ctr_world_query *q = safemalloc (sizeof (ctr_world_query));
+  memset (q, 0, sizeof (ctr_world_query));
+  return q;
+}
 
-/* Cleans up the query context after usage and
- * calls change callbacks if needed.
+void ctr_world_query_free (ctr_world_query *q)
+{
+  if (ctr_world_query_cur == q)
+    ctr_world_query_cur = &ctr_world_query_default;
+  if (q->chunks)
+    safefree (q->chunks);
+  safefree (q);
+}
+
+/* Cleans up the query context after usage and calls the change
+ * callbacks (once, with all changes) if needed.
  *
- * no_update == 0 - Call callbacks for every changed/dirty chunk.
- * no_update == 1 - Don't call any callbacks.
- * no_update == 2 - Call callbacks for every chunk in the context.
+ * no_update == 0 - Report every changed/dirty chunk.
+ * no_update == 1 - Don't report any chunks (active cells are still reported).
+ * no_update == 2 - Report every chunk in the context.
  */
 int ctr_world_query_desetup (int no_update) // no_update == 2 means: force update
 {
@@ -83,6 +123,7 @@ int ctr_world_query_desetup (int no_update) // no_update == 2 means: force updat
         }
 
   QUERY_CONTEXT.loaded = 0;
+  ctr_world_flush_changes ();
   return cnt;
 }
 
@@ -104,6 +145,16 @@ void ctr_world_query_setup (int x, int y, int z, int ex, int ey, int ez)
   QUERY_CONTEXT.y_w = (ey - y) + 1;
   QUERY_CONTEXT.z_w = (ez - z) + 1;
 
+  unsigned int len = QUERY_CONTEXT.x_w * QUERY_CONTEXT.y_w * QUERY_CONTEXT.z_w;
+  if (len > QUERY_CONTEXT.chunks_len)
+    {
+      if (QUERY_CONTEXT.chunks)
+        safefree (QUERY_CONTEXT.chunks);
+      QUERY_CONTEXT.chunks = safemalloc (sizeof (ctr_chunk *) * len);
+      QUERY_CONTEXT.chunks_len = len;
+    }
+  memset (QUERY_CONTEXT.chunks, 0, sizeof (ctr_chunk *) * len);
+
   QUERY_CONTEXT.loaded = 0;
 }
 
@@ -118,9 +169,23 @@ void ctr_world_query_load_chunks (int alloc)
           int ox = x - QUERY_CONTEXT.chnk_x;
           int oy = y - QUERY_CONTEXT.chnk_y;
           int oz = z - QUERY_CONTEXT.chnk_z;
-          ctr_chunk *c = QUERY_CHUNK(ox, oy, oz) = ctr_world_chunk (x, y, z, alloc);
+
+          /* Follow the link of the chunk loaded before, and only look up
+           * the chunk directory if we don't know better.
+           */
+          ctr_chunk *c = 0;
+          ctr_chunk *left = ox > 0 ? QUERY_CHUNK(ox - 1, oy, oz) : 0;
+          if (left)
+            c = left->neighbours[CHUNK_RIGHT];
+          if (!c && (alloc || !left))
+            c = ctr_world_chunk_lookup (x, y, z, alloc);
+
+          QUERY_CHUNK(ox, oy, oz) = c;
           if (c)
-            ctr_chunk_clear_changes (c);
+            {
+              // packed chunks are unpacked by ctr_world_query_cell_at ().
+              c->touched = WORLD.tick;
+            }
         }
   QUERY_CONTEXT.loaded = 1;
 }
@@ -136,16 +201,13 @@ void ctr_world_query_rel2abs (int *rel_x, int *rel_y, int *rel_z)
 // Compute the context relative coordinates from absolute ones.
 void ctr_world_query_abs2rel (int *x, int *y, int *z)
 {
-  vec3_init (pos, *x, *y, *z);
-  vec3_s_div (pos, CHUNK_SIZE);
-  vec3_floor (pos);
-  int chnk_x = pos[0],
-      chnk_y = pos[1],
-      chnk_z = pos[2];
+  int chnk_x = CHUNK_DIV (*x),
+      chnk_y = CHUNK_DIV (*y),
+      chnk_z = CHUNK_DIV (*z);
 
-  *x -= chnk_x * CHUNK_SIZE;
-  *y -= chnk_y * CHUNK_SIZE;
-  *z -= chnk_z * CHUNK_SIZE;
+  *x = CHUNK_MOD (*x);
+  *y = CHUNK_MOD (*y);
+  *z = CHUNK_MOD (*z);
 
   chnk_x -= QUERY_CONTEXT.chnk_x;
   chnk_y -= QUERY_CONTEXT.chnk_y;
@@ -159,7 +221,11 @@ void ctr_world_query_abs2rel (int *x, int *y, int *z)
   *z += chnk_z * CHUNK_SIZE;
 }
 
-ctr_cell *ctr_world_query_cell_at (unsigned int rel_x, unsigned int rel_y, unsigned int rel_z, int modify)
+/* Returns the chunk of the cell at the context relative position
+ * and stores the offset of the cell in offs, so that it can be accessed
+ * with the CELL_* macros. Returns 0 if there is no cell at that position.
+ */
+ctr_chunk *ctr_world_query_cell_at (unsigned int rel_x, unsigned int rel_y, unsigned int rel_z, int modify, unsigned int *offs)
 {
   if (rel_x < 0) return 0;
   if (rel_y < 0) return 0;
@@ -168,9 +234,9 @@ ctr_cell *ctr_world_query_cell_at (unsigned int rel_x, unsigned int rel_y, unsig
   int chnk_x = rel_x / CHUNK_SIZE,
       chnk_y = rel_y / CHUNK_SIZE,
       chnk_z = rel_z / CHUNK_SIZE;
-  int chnk_rel_x = rel_x - chnk_x * CHUNK_SIZE,
-      chnk_rel_y = rel_y - chnk_y * CHUNK_SIZE,
-      chnk_rel_z = rel_z - chnk_z * CHUNK_SIZE;
+  int chnk_rel_x = rel_x % CHUNK_SIZE,
+      chnk_rel_y = rel_y % CHUNK_SIZE,
+      chnk_rel_z = rel_z % CHUNK_SIZE;
 
   assert (QUERY_CONTEXT.loaded);
 
@@ -182,43 +248,263 @@ ctr_cell *ctr_world_query_cell_at (unsigned int rel_x, unsigned int rel_y, unsig
   if (!chnk)
     return 0;
 
-  ctr_cell *c =
-    ctr_chunk_cell_at_rel (chnk, chnk_rel_x, chnk_rel_y, chnk_rel_z);
+  if (chnk->packed)
+    ctr_chunk_unpack (chnk);
+
+  *offs = REL_POS2OFFS (chnk_rel_x, chnk_rel_y, chnk_rel_z);
 
   if (modify)
-    chnk->dirty = 1;
-    //ctr_chunk_cell_changed (chnk, chnk_rel_x, chnk_rel_y, chnk_rel_z);
+    ctr_chunk_cell_changed (chnk, *offs);
+
+  return chnk;
+}
+
+/* A cursor walks a box of cells of the query context (context relative
+ * coordinates, both corners inclusive) chunk by chunk, and hands out the
+ * cells in spans: runs of cells along the x axis, which are consecutive
+ * in the planes of the chunk too. Chunks that are not loaded are skipped,
+ * packed ones are unpacked. With modify set, every chunk the cursor
+ * enters counts as changed as a whole, and its index of special cells
+ * is rebuilt later.
+ *
+ *   ctr_world_query_cursor c;
+ *   ctr_world_query_cursor_init (&c, x, y, z, ex, ey, ez, 0);
+ *   while (ctr_world_query_cursor_next (&c))
+ *     for (i = 0; i < c.len; i++)
+ *       ... CELL_TYPE (c.chnk, c.offs + i) is the cell at c.x + i, c.y, c.z
+ */
+typedef struct _ctr_world_query_cursor {
+    int modify;
+
+    // the box, clipped to the context
+    int bx, by, bz, ebx, eby, ebz;
+
+    // the current chunk (in context chunk coordinates), the range of chunks
+    // to walk and the part of the box that is in the current chunk
+    // (chunk relative, inclusive)
+    int cx, cy, cz;
+    int cx0, cy0, cz0, cx1, cy1, cz1;
+    int x0, y0, z0, x1, y1, z1;
+    int ry, rz; // the next row
+
+    // the current span:
+    ctr_chunk   *chnk;
+    unsigned int offs; // of the first cell
+    unsigned int len;
+    int x, y, z;       // context relative position of the first cell
+} ctr_world_query_cursor;
+
+void ctr_world_query_cursor_init (ctr_world_query_cursor *c, int x, int y, int z, int ex, int ey, int ez, int modify)
+{
+  assert (QUERY_CONTEXT.loaded);
+
+  if (x > ex) SWAP(int,x,ex);
+  if (y > ey) SWAP(int,y,ey);
+  if (z > ez) SWAP(int,z,ez);
+
+  memset (c, 0, sizeof (ctr_world_query_cursor));
+  c->modify = modify;
+  c->bx  = x < 0 ? 0 : x;
+  c->by  = y < 0 ? 0 : y;
+  c->bz  = z < 0 ? 0 : z;
+  c->ebx = ex >= QUERY_CONTEXT.x_w * CHUNK_SIZE ? QUERY_CONTEXT.x_w * CHUNK_SIZE - 1 : ex;
+  c->eby = ey >= QUERY_CONTEXT.y_w * CHUNK_SIZE ? QUERY_CONTEXT.y_w * CHUNK_SIZE - 1 : ey;
+  c->ebz = ez >= QUERY_CONTEXT.z_w * CHUNK_SIZE ? QUERY_CONTEXT.z_w * CHUNK_SIZE - 1 : ez;
+
+  c->cx0 = c->bx / CHUNK_SIZE;  c->cx1 = c->ebx / CHUNK_SIZE;
+  c->cy0 = c->by / CHUNK_SIZE;  c->cy1 = c->eby / CHUNK_SIZE;
+  c->cz0 = c->bz / CHUNK_SIZE;  c->cz1 = c->ebz / CHUNK_SIZE;
+  c->cx  = c->cx0 - 1;
+  c->cy  = c->cy0;
+  c->cz  = c->cz0;
+
+  if (c->bx > c->ebx || c->by > c->eby || c->bz > c->ebz)
+    c->cz = c->cz1 + 1; // empty box
+}
 
-  return c;
+// Sets up the cursor to walk all cells of the query context.
+void ctr_world_query_cursor_init_all (ctr_world_query_cursor *c, int modify)
+{
+  ctr_world_query_cursor_init (
+    c, 0, 0, 0,
+    QUERY_CONTEXT.x_w * CHUNK_SIZE - 1,
+    QUERY_CONTEXT.y_w * CHUNK_SIZE - 1,
+    QUERY_CONTEXT.z_w * CHUNK_SIZE - 1,
+    modify);
+}
+
+// Moves the cursor to the next loaded chunk, returns 0 if there is none.
+static int ctr_world_query_cursor_enter (ctr_world_query_cursor *c)
+{
+  c->chnk = 0;
+  while (c->cz <= c->cz1)
+    {
+      if (++c->cx > c->cx1)
+        {
+          c->cx = c->cx0;
+          if (++c->cy > c->cy1)
+            {
+              c->cy = c->cy0;
+              if (++c->cz > c->cz1)
+                return 0;
+            }
+        }
+
+      ctr_chunk *chnk = QUERY_CHUNK(c->cx, c->cy, c->cz);
+      if (!chnk)
+        continue;
+
+      if (chnk->packed)
+        ctr_chunk_unpack (chnk);
+      if (c->modify)
+        {
+          ctr_chunk_unshare (chnk);
+          chnk->dirty = 1;
+          chnk->summary_stale = 1;
+          ctr_chunk_all_changed (chnk);
+          ctr_chunk_visibility_changed (chnk, CTR_ALL_FACES);
+        }
+      c->chnk = chnk;
+
+      int ox = c->cx * CHUNK_SIZE,
+          oy = c->cy * CHUNK_SIZE,
+          oz = c->cz * CHUNK_SIZE;
+      c->x0 = c->bx > ox ? c->bx - ox : 0;
+      c->y0 = c->by > oy ? c->by - oy : 0;
+      c->z0 = c->bz > oz ? c->bz - oz : 0;
+      c->x1 = c->ebx < ox + CHUNK_SIZE ? c->ebx - ox : CHUNK_SIZE - 1;
+      c->y1 = c->eby < oy + CHUNK_SIZE ? c->eby - oy : CHUNK_SIZE - 1;
+      c->z1 = c->ebz < oz + CHUNK_SIZE ? c->ebz - oz : CHUNK_SIZE - 1;
+      c->ry = c->y0;
+      c->rz = c->z0;
+      return 1;
+    }
+
+  return 0;
+}
+
+// Moves the cursor to the next span, returns 0 when the box is done.
+int ctr_world_query_cursor_next (ctr_world_query_cursor *c)
+{
+  if ((!c->chnk || c->rz > c->z1) && !ctr_world_query_cursor_enter (c))
+    return 0;
+
+  c->offs = REL_POS2OFFS (c->x0, c->ry, c->rz);
+  c->len  = (c->x1 - c->x0) + 1;
+  c->x    = c->cx * CHUNK_SIZE + c->x0;
+  c->y    = c->cy * CHUNK_SIZE + c->ry;
+  c->z    = c->cz * CHUNK_SIZE + c->rz;
+
+  if (++c->ry > c->y1)
+    {
+      c->ry = c->y0;
+      c->rz++;
+    }
+  return 1;
 }
 
 void ctr_world_query_set_at_pl (unsigned int rel_x, unsigned int rel_y, unsigned int rel_z, AV *cell)
 {
-  ctr_cell *c = ctr_world_query_cell_at (rel_x, rel_y, rel_z, 1);
+  unsigned int offs;
+  ctr_chunk *c = ctr_world_query_cell_at (rel_x, rel_y, rel_z, 1, &offs);
   if (!c)
     return;
 
-  int otype = c->type;
+  int otype = CELL_TYPE (c, offs);
 
   SV **t = av_fetch (cell, 0, 0);
-  if (t) c->type = SvIV (*t);
+  if (t) CELL_TYPE (c, offs) = SvIV (*t);
 
   t = av_fetch (cell, 1, 0);
-  if (t) c->light = SvIV (*t);
+  if (t) CELL_LIGHT (c, offs) = SvIV (*t);
 
   t = av_fetch (cell, 2, 0);
-  if (t) c->meta = SvIV (*t);
+  if (t) CELL_META (c, offs) = SvIV (*t);
 
   t = av_fetch (cell, 3, 0);
-  if (t) c->add = SvIV (*t);
+  if (t) CELL_ADD (c, offs) = SvIV (*t);
 
   t = av_fetch (cell, 4, 0);
-  if (t) c->visible = SvIV (*t);
+  if (t) CELL_SET_VISIBLE (c, offs, SvIV (*t));
+
+  ctr_chunk_type_changed (c, offs, otype, CELL_TYPE (c, offs));
 
-  if (ctr_world_is_active (otype) || ctr_world_is_active (c->type))
+  if (ctr_world_is_active (otype) || ctr_world_is_active (CELL_TYPE (c, offs)))
     {
       t = av_fetch (cell, 5, 0);
       ctr_world_query_rel2abs (&rel_x, &rel_y, &rel_z);
-      ctr_world_emit_active_cell_change (rel_x, rel_y, rel_z, c, t ? *t : 0);
+      ctr_world_emit_active_cell_change (
+        rel_x, rel_y, rel_z, CELL_TYPE (c, offs), t ? *t : 0);
+    }
+}
+
+// For qsort ().
+static int ctr_cmp_int (const void *a, const void *b)
+{
+  int ia = *((const int *) a), ib = *((const int *) b);
+  return ia < ib ? -1 : ia > ib;
+}
+
+/* Searches the query context for cells of the types t1, t2 or t3 and
+ * pushes their absolute coordinates onto out. If all types are light
+ * sources or active types only the index of special cells of the
+ * chunks is searched, otherwise all cells. The results are ordered chunk
+ * by chunk.
+ */
+void ctr_world_query_search_types (int t1, int t2, int t3, AV *out)
+{
+  int ox = QUERY_CONTEXT.chnk_x * CHUNK_SIZE,
+      oy = QUERY_CONTEXT.chnk_y * CHUNK_SIZE,
+      oz = QUERY_CONTEXT.chnk_z * CHUNK_SIZE;
+
+  if (CTR_IS_SPECIAL_TYPE (t1) && CTR_IS_SPECIAL_TYPE (t2) && CTR_IS_SPECIAL_TYPE (t3))
+    {
+      int cx, cy, cz;
+      for (cz = 0; cz < QUERY_CONTEXT.z_w; cz++)
+        for (cy = 0; cy < QUERY_CONTEXT.y_w; cy++)
+          for (cx = 0; cx < QUERY_CONTEXT.x_w; cx++)
+            {
+              ctr_chunk *chnk = QUERY_CHUNK(cx, cy, cz);
+              if (!chnk)
+                continue;
+
+              unsigned short *special = ctr_chunk_special (chnk);
+              unsigned int i;
+              for (i = 0; i < chnk->special_len; i++)
+                {
+                  unsigned int offs = special[i];
+                  ctr_cell cell;
+                  if (chnk->packed)
+                    ctr_chunk_packed_cell (chnk, offs, &cell);
+                  else
+                    cell.type = CELL_TYPE (chnk, offs);
+
+                  int type = cell.type;
+                  if (type != t1 && type != t2 && type != t3)
+                    continue;
+
+                  av_push (out, newSViv (ox + cx * CHUNK_SIZE + offs % CHUNK_SIZE));
+                  av_push (out, newSViv (oy + cy * CHUNK_SIZE + (offs / CHUNK_SIZE) % CHUNK_SIZE));
+                  av_push (out, newSViv (oz + cz * CHUNK_SIZE + offs / (CHUNK_SIZE * CHUNK_SIZE)));
+                }
+            }
+      return;
+    }
+
+  ctr_world_query_cursor c;
+  ctr_world_query_cursor_init_all (&c, 0);
+  while (ctr_world_query_cursor_next (&c))
+    {
+      unsigned short *type = &(c.chnk->cells->type[c.offs]);
+      unsigned int i;
+      for (i = 0; i < c.len; i++)
+        {
+          if (type[i] != t1 && type[i] != t2 && type[i] != t3)
+            continue;
+
+          av_push (out, newSViv (ox + c.x + i));
+          av_push (out, newSViv (oy + c.y));
+          av_push (out, newSViv (oz + c.z));
+        }
     }
 }